@@ -0,0 +1,274 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "async_cosim.h"
+
+#include <cassert>
+
+// Number of times a thread polls for the other thread to make progress before
+// going to sleep. Polling keeps the hand-over quick when the other thread is
+// busy, sleeping stops an idle thread from occupying a CPU.
+static const int kSpinIterations = 4096;
+
+// Wait until `done` returns true. `sleeping` is set whilst blocked on `cv` so
+// the thread that makes `done` true knows to call `wake`.
+template <typename Pred>
+static void spin_then_wait(std::mutex &mutex, std::condition_variable &cv,
+                           std::atomic<bool> &sleeping, Pred done) {
+  for (int i = 0; i < kSpinIterations; ++i) {
+    if (done()) {
+      return;
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  // Sequentially consistent with the update the other thread makes before
+  // checking `sleeping` in `wake`, so either that update is seen by `done` or
+  // the other thread sees `sleeping` and notifies.
+  sleeping.store(true);
+  cv.wait(lock, done);
+  sleeping.store(false);
+}
+
+static void wake(std::mutex &mutex, std::condition_variable &cv,
+                 std::atomic<bool> &sleeping) {
+  if (sleeping.load()) {
+    std::lock_guard<std::mutex> lock(mutex);
+    cv.notify_one();
+  }
+}
+
+AsyncCosim::AsyncCosim(Cosim *cosim)
+    : CosimWrapper(cosim),
+      events_pushed(0),
+      events_processed(0),
+      worker_sleeping(false),
+      sim_sleeping(false),
+      failed(false),
+      stop_worker(false) {
+  assert(cosim);
+
+  worker = std::thread(&AsyncCosim::worker_loop, this);
+}
+
+AsyncCosim::~AsyncCosim() {
+  wait_idle();
+
+  stop_worker.store(true);
+  wake(wait_mutex, worker_cv, worker_sleeping);
+  worker.join();
+}
+
+void AsyncCosim::wait_idle() {
+  uint64_t pushed = events_pushed.load(std::memory_order_relaxed);
+
+  spin_then_wait(wait_mutex, sim_cv, sim_sleeping,
+                 [&] { return events_processed.load() == pushed; });
+}
+
+void AsyncCosim::push_event(const Event &event) {
+  while (true) {
+    // Sampled before the push so a full queue can only be waited on whilst
+    // the worker still has events to process
+    uint64_t processed = events_processed.load();
+
+    if (queue.try_push(event)) {
+      break;
+    }
+
+    spin_then_wait(wait_mutex, sim_cv, sim_sleeping,
+                   [&] { return events_processed.load() != processed; });
+  }
+
+  events_pushed.fetch_add(1);
+  wake(wait_mutex, worker_cv, worker_sleeping);
+}
+
+void AsyncCosim::process_event(const Event &event) {
+  // Once a check has failed the co-simulator state is no longer meaningful, so
+  // discard everything up to the next `clear_errors`.
+  if (failed.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  bool step_ok = true;
+
+  switch (event.type) {
+    case Event::kStep:
+      step_ok = cosim->step(
+          event.retire_info.write_reg, event.retire_info.write_reg_data,
+          event.retire_info.pc, event.retire_info.sync_trap);
+      break;
+    case Event::kRetire:
+      step_ok = cosim->step_batch(&event.retire_info, 1) == 1;
+      break;
+    case Event::kSetMip:
+      cosim->set_mip(event.val_32);
+      return;
+    case Event::kSetNmi:
+      cosim->set_nmi(event.val_bool);
+      return;
+    case Event::kSetDebugReq:
+      cosim->set_debug_req(event.val_bool);
+      return;
+    case Event::kSetMcycle:
+      cosim->set_mcycle(event.mcycle);
+      return;
+    case Event::kDSideAccess:
+      cosim->notify_dside_access(event.dside_access);
+      return;
+    case Event::kIsideError:
+      cosim->set_iside_error(event.val_32);
+      return;
+  }
+
+  if (!step_ok) {
+    failed.store(true, std::memory_order_release);
+  }
+}
+
+void AsyncCosim::worker_loop() {
+  Event event;
+
+  while (true) {
+    if (queue.try_pop(event)) {
+      process_event(event);
+      events_processed.fetch_add(1);
+      wake(wait_mutex, sim_cv, sim_sleeping);
+    } else if (stop_worker.load()) {
+      break;
+    } else {
+      uint64_t processed = events_processed.load(std::memory_order_relaxed);
+
+      spin_then_wait(wait_mutex, worker_cv, worker_sleeping, [&] {
+        return events_pushed.load() != processed || stop_worker.load();
+      });
+    }
+  }
+}
+
+void AsyncCosim::add_memory(uint32_t base_addr, size_t size) {
+  wait_idle();
+  cosim->add_memory(base_addr, size);
+}
+
+bool AsyncCosim::backdoor_write_mem(uint32_t addr, size_t len,
+                                    const uint8_t *data_in) {
+  wait_idle();
+  return cosim->backdoor_write_mem(addr, len, data_in);
+}
+
+bool AsyncCosim::backdoor_read_mem(uint32_t addr, size_t len,
+                                   uint8_t *data_out) {
+  wait_idle();
+  return cosim->backdoor_read_mem(addr, len, data_out);
+}
+
+bool AsyncCosim::step(uint32_t write_reg, uint32_t write_reg_data, uint32_t pc,
+                      bool sync_trap) {
+  Event event;
+  event.type = Event::kStep;
+  event.retire_info.write_reg = write_reg;
+  event.retire_info.write_reg_data = write_reg_data;
+  event.retire_info.pc = pc;
+  event.retire_info.sync_trap = sync_trap;
+
+  push_event(event);
+
+  return !failed.load(std::memory_order_acquire);
+}
+
+int AsyncCosim::step_batch(const RetireInfo *retire_info, int num_insns) {
+  Event event;
+  event.type = Event::kRetire;
+
+  for (int i = 0; i < num_insns; ++i) {
+    event.retire_info = retire_info[i];
+    push_event(event);
+  }
+
+  // A failure seen here belongs to an instruction from an earlier call, so
+  // none of this batch can be reported as checked.
+  return failed.load(std::memory_order_acquire) ? 0 : num_insns;
+}
+
+void AsyncCosim::set_mip(uint32_t mip) {
+  Event event;
+  event.type = Event::kSetMip;
+  event.val_32 = mip;
+
+  push_event(event);
+}
+
+void AsyncCosim::set_nmi(bool nmi) {
+  Event event;
+  event.type = Event::kSetNmi;
+  event.val_bool = nmi;
+
+  push_event(event);
+}
+
+void AsyncCosim::set_debug_req(bool debug_req) {
+  Event event;
+  event.type = Event::kSetDebugReq;
+  event.val_bool = debug_req;
+
+  push_event(event);
+}
+
+void AsyncCosim::set_mcycle(uint64_t mcycle) {
+  Event event;
+  event.type = Event::kSetMcycle;
+  event.mcycle = mcycle;
+
+  push_event(event);
+}
+
+void AsyncCosim::notify_dside_access(const DSideAccessInfo &access_info) {
+  Event event;
+  event.type = Event::kDSideAccess;
+  event.dside_access = access_info;
+
+  push_event(event);
+}
+
+void AsyncCosim::set_iside_error(uint32_t addr) {
+  Event event;
+  event.type = Event::kIsideError;
+  event.val_32 = addr;
+
+  push_event(event);
+}
+
+const std::vector<std::string> &AsyncCosim::get_errors() {
+  wait_idle();
+  return cosim->get_errors();
+}
+
+void AsyncCosim::clear_errors() {
+  wait_idle();
+
+  cosim->clear_errors();
+  failed.store(false, std::memory_order_release);
+}
+
+int AsyncCosim::get_insn_cnt() {
+  wait_idle();
+  return cosim->get_insn_cnt();
+}
+
+CosimStats AsyncCosim::get_stats() {
+  wait_idle();
+  return CosimWrapper::get_stats();
+}
+
+std::shared_ptr<CosimState> AsyncCosim::save_state() {
+  wait_idle();
+  return cosim->save_state();
+}
+
+bool AsyncCosim::restore_state(const std::shared_ptr<CosimState> &state) {
+  wait_idle();
+  return cosim->restore_state(state);
+}
@@ -0,0 +1,119 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef ASYNC_COSIM_H_
+#define ASYNC_COSIM_H_
+
+#include "cosim.h"
+#include "cosim_wrapper.h"
+#include "spsc_queue.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs another `Cosim` implementation on a dedicated worker thread.
+//
+// Calls that feed the co-simulator (`step`, `step_batch`, `set_mip`,
+// `set_nmi`, `set_debug_req`, `set_mcycle`, `notify_dside_access` and
+// `set_iside_error`) are queued and return immediately, so the simulation
+// thread can carry on evaluating the DUT while the wrapped co-simulator checks
+// earlier instructions. All other calls wait for the queue to drain before
+// being forwarded.
+//
+// Errors are reported asynchronously. Once the worker sees a mismatch it stops
+// checking and the next `step` or `step_batch` call returns a failure, which
+// may be for an instruction from an earlier call. The wrapped co-simulator's
+// errors (from `get_errors`) identify the instruction that failed.
+class AsyncCosim : public CosimWrapper {
+ public:
+  // `cosim` must outlive this object and must not be used directly while this
+  // object exists.
+  AsyncCosim(Cosim *cosim);
+  ~AsyncCosim();
+
+  // Block until the worker has processed every queued call
+  void wait_idle();
+
+  // Cosim implementation
+  void add_memory(uint32_t base_addr, size_t size) override;
+  bool backdoor_write_mem(uint32_t addr, size_t len,
+                          const uint8_t *data_in) override;
+  bool backdoor_read_mem(uint32_t addr, size_t len, uint8_t *data_out) override;
+  bool step(uint32_t write_reg, uint32_t write_reg_data, uint32_t pc,
+            bool sync_trap) override;
+  int step_batch(const RetireInfo *retire_info, int num_insns) override;
+  void set_mip(uint32_t mip) override;
+  void set_nmi(bool nmi) override;
+  void set_debug_req(bool debug_req) override;
+  void set_mcycle(uint64_t mcycle) override;
+  void notify_dside_access(const DSideAccessInfo &access_info) override;
+  void set_iside_error(uint32_t addr) override;
+  const std::vector<std::string> &get_errors() override;
+  void clear_errors() override;
+  int get_insn_cnt() override;
+  CosimStats get_stats() override;
+  std::shared_ptr<CosimState> save_state() override;
+  bool restore_state(const std::shared_ptr<CosimState> &state) override;
+
+ private:
+  struct Event {
+    enum {
+      kStep,
+      kRetire,
+      kSetMip,
+      kSetNmi,
+      kSetDebugReq,
+      kSetMcycle,
+      kDSideAccess,
+      kIsideError
+    } type;
+
+    union {
+      // Used by kStep (only the `step` arguments are valid) and kRetire
+      RetireInfo retire_info;
+      DSideAccessInfo dside_access;
+      // Used by kSetMip and kIsideError
+      uint32_t val_32;
+      // Used by kSetNmi and kSetDebugReq
+      bool val_bool;
+      uint64_t mcycle;
+    };
+  };
+
+  static const size_t kQueueCapacity = 4096;
+
+  SpscQueue<Event, kQueueCapacity> queue;
+  std::thread worker;
+
+  // Number of events pushed by the simulation thread and processed by the
+  // worker thread. The worker is idle when the two are equal.
+  std::atomic<uint64_t> events_pushed;
+  std::atomic<uint64_t> events_processed;
+
+  // Each thread polls for a while before sleeping on its condition variable
+  // (`worker_cv` for the worker waiting for events, `sim_cv` for the
+  // simulation thread waiting for the worker to catch up). The sleeping flags
+  // tell the other thread a notify is needed.
+  std::mutex wait_mutex;
+  std::condition_variable worker_cv;
+  std::condition_variable sim_cv;
+  std::atomic<bool> worker_sleeping;
+  std::atomic<bool> sim_sleeping;
+
+  // Set by the worker when a check fails
+  std::atomic<bool> failed;
+
+  std::atomic<bool> stop_worker;
+
+  void push_event(const Event &event);
+  void process_event(const Event &event);
+  void worker_loop();
+};
+
+#endif  // ASYNC_COSIM_H_
@@ -2,6 +2,8 @@
 // Licensed under the Apache License, Version 2.0, see LICENSE for details.
 // SPDX-License-Identifier: Apache-2.0
 
+#include <stdint.h>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -37,8 +39,55 @@ struct DSideAccessInfo {
   bool misaligned_second;
 };
 
+// Information about an instruction retired (or synchronously trapped) by the
+// DUT, along with the interrupt, debug request and mcycle state observed
+// alongside it. Used to check several instructions with a single call to
+// `step_batch`.
+struct RetireInfo {
+  // `write_reg`, `write_reg_data`, `pc` and `sync_trap` have the same meaning
+  // as the arguments of `step`.
+  uint32_t write_reg;
+  uint32_t write_reg_data;
+  uint32_t pc;
+  bool sync_trap;
+
+  // Values passed to `set_mip`, `set_nmi`, `set_debug_req` and `set_mcycle`
+  // before the instruction is stepped.
+  uint32_t mip;
+  bool nmi;
+  bool debug_req;
+  uint64_t mcycle;
+};
+
+// Counters and timers describing co-simulator throughput, see
+// `Cosim::get_stats`. Times are wall-clock times in nanoseconds.
+struct CosimStats {
+  // Number of `step` calls (including those made by `step_batch`), whether or
+  // not checking passed
+  uint64_t insns_stepped;
+  // Number of notified DUT dside accesses and how many of those have been
+  // matched against an ISS access
+  uint64_t dside_accesses_notified;
+  uint64_t dside_accesses_matched;
+  // Time spent executing instructions in the ISS. This includes the time spent
+  // checking memory accesses, which happens as the ISS executes.
+  uint64_t step_time_ns;
+  // Time spent checking ISS memory accesses against notified DUT accesses
+  uint64_t check_mem_time_ns;
+  // Number of calls made through the DPI interface, see
+  // `Cosim::count_dpi_call`
+  uint64_t dpi_calls;
+};
+
+// Co-simulator state captured by `Cosim::save_state`. Its contents are
+// specific to the co-simulator that produced it.
+struct CosimState {
+  virtual ~CosimState() {}
+};
+
 class Cosim {
  public:
+  Cosim() : num_dpi_calls(0) {}
   virtual ~Cosim() {}
 
   // Add a memory to the co-simulator environment.
@@ -74,6 +123,34 @@ class Cosim {
   virtual bool step(uint32_t write_reg, uint32_t write_reg_data, uint32_t pc,
                     bool sync_trap) = 0;
 
+  // Step the co-simulator through a batch of instructions. For each entry of
+  // `retire_info` in turn this is equivalent to calling `set_nmi`, `set_mip`,
+  // `set_debug_req` and `set_mcycle` with the supplied values followed by
+  // `step`.
+  //
+  // Checking stops at the first instruction with errors. Returns the number of
+  // instructions that were checked without errors, so a return value less than
+  // `num_insns` gives the index of the failing instruction; use `get_errors` to
+  // obtain details. A co-simulator that checks asynchronously (see
+  // `AsyncCosim`) may instead report the failure of an instruction from an
+  // earlier call, the errors identify the instruction that failed.
+  virtual int step_batch(const RetireInfo *retire_info, int num_insns) {
+    for (int i = 0; i < num_insns; ++i) {
+      const RetireInfo &insn = retire_info[i];
+
+      set_nmi(insn.nmi);
+      set_mip(insn.mip);
+      set_debug_req(insn.debug_req);
+      set_mcycle(insn.mcycle);
+
+      if (!step(insn.write_reg, insn.write_reg_data, insn.pc, insn.sync_trap)) {
+        return i;
+      }
+    }
+
+    return num_insns;
+  }
+
   // When more than one of `set_mip`, `set_nmi` or `set_debug_req` is called
   // before `step` which one takes effect is chosen by the co-simulator. Which
   // should take priority is architecturally defined by the RISC-V
@@ -136,6 +213,34 @@ class Cosim {
   // Returns a count of instructions executed by co-simulator and DUT without
   // failures.
   virtual int get_insn_cnt() = 0;
+
+  // Get throughput counters and timers covering everything since the
+  // co-simulator was created. Divide `dpi_calls` by `insns_stepped` to get the
+  // DPI calls per instruction.
+  virtual CosimStats get_stats() = 0;
+
+  // Count a call made through the DPI interface, called by the DPI wrappers in
+  // cosim_dpi.cc. `get_stats` implementations report the count in
+  // `CosimStats::dpi_calls`.
+  void count_dpi_call() { ++num_dpi_calls; }
+
+  // Capture the co-simulator state: architectural state, memory contents and
+  // any pending notified accesses. Errors are not part of the captured state.
+  //
+  // Memory is captured copy-on-write, so saving state is cheap. Whilst any
+  // returned state is still referenced memory pages are copied the first time
+  // they're written.
+  virtual std::shared_ptr<CosimState> save_state() = 0;
+
+  // Return the co-simulator to a state captured by `save_state`. A state may
+  // be restored any number of times.
+  //
+  // Returns false if `state` wasn't captured by this co-simulator.
+  virtual bool restore_state(const std::shared_ptr<CosimState> &state) = 0;
+
+ protected:
+  // Number of calls counted by `count_dpi_call`
+  uint64_t num_dpi_calls;
 };
 
 #endif  // COSIM_H_
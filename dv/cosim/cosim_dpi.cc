@@ -4,6 +4,7 @@
 
 #include <svdpi.h>
 #include <cassert>
+#include <vector>
 
 #include "cosim.h"
 #include "cosim_dpi.h"
@@ -12,30 +13,69 @@ int riscv_cosim_step(Cosim *cosim, const svBitVecVal *write_reg,
                      const svBitVecVal *write_reg_data, const svBitVecVal *pc,
                      svBit sync_trap) {
   assert(cosim);
+  cosim->count_dpi_call();
 
   return cosim->step(write_reg[0], write_reg_data[0], pc[0], sync_trap) ? 1 : 0;
 }
 
+int riscv_cosim_step_batch(Cosim *cosim, const svOpenArrayHandle retire_info,
+                           int num_insns) {
+  assert(cosim);
+  cosim->count_dpi_call();
+  assert(num_insns <= svSize(retire_info, 1));
+
+  // Reused between calls so checking a batch doesn't allocate once the buffer
+  // has grown to the batch size
+  static thread_local std::vector<RetireInfo> retire_info_unpacked;
+  if (retire_info_unpacked.size() < (size_t)num_insns) {
+    retire_info_unpacked.resize(num_insns);
+  }
+
+  // See cosim_dpi.svh for the layout of each packed record
+  int first_idx = svLow(retire_info, 1);
+  for (int i = 0; i < num_insns; ++i) {
+    const svBitVecVal *record = static_cast<const svBitVecVal *>(
+        svGetArrElemPtr1(retire_info, first_idx + i));
+    assert(record);
+
+    retire_info_unpacked[i] =
+        RetireInfo{.write_reg = record[5] & 0x1f,
+                   .write_reg_data = record[1],
+                   .pc = record[0],
+                   .sync_trap = ((record[5] >> 5) & 1) != 0,
+                   .mip = record[2],
+                   .nmi = ((record[5] >> 6) & 1) != 0,
+                   .debug_req = ((record[5] >> 7) & 1) != 0,
+                   .mcycle = record[3] | (uint64_t)record[4] << 32};
+  }
+
+  return cosim->step_batch(retire_info_unpacked.data(), num_insns);
+}
+
 void riscv_cosim_set_mip(Cosim *cosim, const svBitVecVal *mip) {
   assert(cosim);
+  cosim->count_dpi_call();
 
   cosim->set_mip(mip[0]);
 }
 
 void riscv_cosim_set_nmi(Cosim *cosim, svBit nmi) {
   assert(cosim);
+  cosim->count_dpi_call();
 
   cosim->set_nmi(nmi);
 }
 
 void riscv_cosim_set_debug_req(Cosim *cosim, svBit debug_req) {
   assert(cosim);
+  cosim->count_dpi_call();
 
   cosim->set_debug_req(debug_req);
 }
 
 void riscv_cosim_set_mcycle(Cosim *cosim, svBitVecVal *mcycle) {
   assert(cosim);
+  cosim->count_dpi_call();
 
   uint64_t mcycle_full = mcycle[0] | (uint64_t)mcycle[1] << 32;
   cosim->set_mcycle(mcycle_full);
@@ -47,6 +87,7 @@ void riscv_cosim_notify_dside_access(Cosim *cosim, svBit store,
                                      svBit misaligned_first,
                                      svBit misaligned_second) {
   assert(cosim);
+  cosim->count_dpi_call();
 
   cosim->notify_dside_access(
       DSideAccessInfo{.store = store != 0,
@@ -60,18 +101,21 @@ void riscv_cosim_notify_dside_access(Cosim *cosim, svBit store,
 
 void riscv_cosim_set_iside_error(Cosim *cosim, svBitVecVal *addr) {
   assert(cosim);
+  cosim->count_dpi_call();
 
   cosim->set_iside_error(addr[0]);
 }
 
 int riscv_cosim_get_num_errors(Cosim *cosim) {
   assert(cosim);
+  cosim->count_dpi_call();
 
   return cosim->get_errors().size();
 }
 
 const char *riscv_cosim_get_error(Cosim *cosim, int index) {
   assert(cosim);
+  cosim->count_dpi_call();
 
   if (index >= cosim->get_errors().size()) {
     return nullptr;
@@ -82,6 +126,7 @@ const char *riscv_cosim_get_error(Cosim *cosim, int index) {
 
 void riscv_cosim_clear_errors(Cosim *cosim) {
   assert(cosim);
+  cosim->count_dpi_call();
 
   cosim->clear_errors();
 }
@@ -89,12 +134,35 @@ void riscv_cosim_clear_errors(Cosim *cosim) {
 void riscv_cosim_write_mem_byte(Cosim *cosim, const svBitVecVal *addr,
                                 const svBitVecVal *d) {
   assert(cosim);
+  cosim->count_dpi_call();
   uint8_t byte = d[0] & 0xff;
   cosim->backdoor_write_mem(addr[0], 1, &byte);
 }
 
+void riscv_cosim_write_mem_block(Cosim *cosim, const svBitVecVal *addr,
+                                 const svOpenArrayHandle data) {
+  assert(cosim);
+  cosim->count_dpi_call();
+
+  int len = svSize(data, 1);
+  std::vector<uint8_t> bytes;
+  bytes.reserve(len);
+
+  int first_idx = svLow(data, 1);
+  for (int i = 0; i < len; ++i) {
+    const svBitVecVal *d =
+        static_cast<const svBitVecVal *>(svGetArrElemPtr1(data, first_idx + i));
+    assert(d);
+
+    bytes.push_back(d[0] & 0xff);
+  }
+
+  cosim->backdoor_write_mem(addr[0], bytes.size(), bytes.data());
+}
+
 int riscv_cosim_get_insn_cnt(Cosim *cosim) {
   assert(cosim);
+  cosim->count_dpi_call();
 
   return cosim->get_insn_cnt();
 }
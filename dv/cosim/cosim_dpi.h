@@ -15,6 +15,8 @@ extern "C" {
 int riscv_cosim_step(Cosim *cosim, const svBitVecVal *write_reg,
                      const svBitVecVal *write_reg_data, const svBitVecVal *pc,
                      svBit sync_trap);
+int riscv_cosim_step_batch(Cosim *cosim, const svOpenArrayHandle retire_info,
+                           int num_insns);
 void riscv_cosim_set_mip(Cosim *cosim, const svBitVecVal *mip);
 void riscv_cosim_set_nmi(Cosim *cosim, svBit nmi);
 void riscv_cosim_set_debug_req(Cosim *cosim, svBit debug_req);
@@ -30,6 +32,8 @@ const char *riscv_cosim_get_error(Cosim *cosim, int index);
 void riscv_cosim_clear_errors(Cosim *cosim);
 void riscv_cosim_write_mem_byte(Cosim *cosim, const svBitVecVal *addr,
                                 const svBitVecVal *d);
+void riscv_cosim_write_mem_block(Cosim *cosim, const svBitVecVal *addr,
+                                 const svOpenArrayHandle data);
 int riscv_cosim_get_insn_cnt(Cosim *cosim);
 }
 
@@ -0,0 +1,297 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "cosim_trace.h"
+
+#include <cassert>
+#include <cstring>
+
+static const char kTraceMagic[8] = {'I', 'B', 'X', 'C', 'T', 'R', 'C', '1'};
+
+CosimTraceRecorder::CosimTraceRecorder(Cosim *cosim,
+                                       const std::string &trace_path,
+                                       const CosimTraceConfig &config)
+    : CosimWrapper(cosim),
+      trace(trace_path, std::ios::binary | std::ios::trunc) {
+  assert(cosim);
+
+  if (!trace.is_open()) {
+    return;
+  }
+
+  trace.write(kTraceMagic, sizeof(kTraceMagic));
+  write_val<uint32_t>(config.start_pc);
+  write_val<uint32_t>(config.start_mtvec);
+  write_val<uint8_t>(config.secure_ibex);
+  write_val<uint8_t>(config.icache_en);
+  write_val<uint16_t>(config.isa_string.size());
+  trace.write(config.isa_string.data(), config.isa_string.size());
+}
+
+void CosimTraceRecorder::write_step(uint32_t write_reg,
+                                    uint32_t write_reg_data, uint32_t pc,
+                                    bool sync_trap, bool passed) {
+  write_val<uint8_t>(kTraceStep);
+  write_val<uint32_t>(write_reg_data);
+  write_val<uint32_t>(pc);
+  write_val<uint8_t>((passed ? 0x40 : 0) | (sync_trap ? 0x20 : 0) |
+                     (write_reg & 0x1f));
+}
+
+void CosimTraceRecorder::add_memory(uint32_t base_addr, size_t size) {
+  write_val<uint8_t>(kTraceAddMemory);
+  write_val<uint32_t>(base_addr);
+  write_val<uint64_t>(size);
+
+  cosim->add_memory(base_addr, size);
+}
+
+bool CosimTraceRecorder::backdoor_write_mem(uint32_t addr, size_t len,
+                                            const uint8_t *data_in) {
+  write_val<uint8_t>(kTraceWriteMem);
+  write_val<uint32_t>(addr);
+  write_val<uint32_t>(len);
+  trace.write(reinterpret_cast<const char *>(data_in), len);
+
+  return cosim->backdoor_write_mem(addr, len, data_in);
+}
+
+bool CosimTraceRecorder::step(uint32_t write_reg, uint32_t write_reg_data,
+                              uint32_t pc, bool sync_trap) {
+  bool passed = cosim->step(write_reg, write_reg_data, pc, sync_trap);
+  write_step(write_reg, write_reg_data, pc, sync_trap, passed);
+
+  return passed;
+}
+
+int CosimTraceRecorder::step_batch(const RetireInfo *retire_info,
+                                   int num_insns) {
+  // Forward the whole batch so the wrapped co-simulator can use its own
+  // `step_batch`, then record the instructions it checked.
+  int num_passed = cosim->step_batch(retire_info, num_insns);
+  int num_checked = num_passed < num_insns ? num_passed + 1 : num_insns;
+
+  for (int i = 0; i < num_checked; ++i) {
+    const RetireInfo &insn = retire_info[i];
+
+    write_val<uint8_t>(kTraceSetNmi);
+    write_val<uint8_t>(insn.nmi);
+    write_val<uint8_t>(kTraceSetMip);
+    write_val<uint32_t>(insn.mip);
+    write_val<uint8_t>(kTraceSetDebugReq);
+    write_val<uint8_t>(insn.debug_req);
+    write_val<uint8_t>(kTraceSetMcycle);
+    write_val<uint64_t>(insn.mcycle);
+    write_step(insn.write_reg, insn.write_reg_data, insn.pc, insn.sync_trap,
+               i < num_passed);
+  }
+
+  return num_passed;
+}
+
+void CosimTraceRecorder::set_mip(uint32_t mip) {
+  write_val<uint8_t>(kTraceSetMip);
+  write_val<uint32_t>(mip);
+
+  cosim->set_mip(mip);
+}
+
+void CosimTraceRecorder::set_nmi(bool nmi) {
+  write_val<uint8_t>(kTraceSetNmi);
+  write_val<uint8_t>(nmi);
+
+  cosim->set_nmi(nmi);
+}
+
+void CosimTraceRecorder::set_debug_req(bool debug_req) {
+  write_val<uint8_t>(kTraceSetDebugReq);
+  write_val<uint8_t>(debug_req);
+
+  cosim->set_debug_req(debug_req);
+}
+
+void CosimTraceRecorder::set_mcycle(uint64_t mcycle) {
+  write_val<uint8_t>(kTraceSetMcycle);
+  write_val<uint64_t>(mcycle);
+
+  cosim->set_mcycle(mcycle);
+}
+
+void CosimTraceRecorder::notify_dside_access(
+    const DSideAccessInfo &access_info) {
+  write_val<uint8_t>(kTraceDSideAccess);
+  write_val<uint32_t>(access_info.addr);
+  write_val<uint32_t>(access_info.data);
+  write_val<uint8_t>((access_info.misaligned_second ? 0x80 : 0) |
+                     (access_info.misaligned_first ? 0x40 : 0) |
+                     (access_info.error ? 0x20 : 0) |
+                     (access_info.store ? 0x10 : 0) | (access_info.be & 0xf));
+
+  cosim->notify_dside_access(access_info);
+}
+
+void CosimTraceRecorder::set_iside_error(uint32_t addr) {
+  write_val<uint8_t>(kTraceIsideError);
+  write_val<uint32_t>(addr);
+
+  cosim->set_iside_error(addr);
+}
+
+void CosimTraceRecorder::clear_errors() {
+  write_val<uint8_t>(kTraceClearErrors);
+
+  cosim->clear_errors();
+}
+
+CosimTraceReader::CosimTraceReader(const std::string &trace_path)
+    : trace(trace_path, std::ios::binary),
+      header_ok(false),
+      steps_replayed(0),
+      last_step_pc(0),
+      recorded_failures(0),
+      first_failed_step(0),
+      first_failed_pc(0) {
+  char magic[sizeof(kTraceMagic)];
+  uint8_t secure_ibex, icache_en;
+  uint16_t isa_len;
+
+  if (!trace.read(magic, sizeof(magic)) ||
+      memcmp(magic, kTraceMagic, sizeof(magic)) != 0) {
+    return;
+  }
+
+  if (!read_val(config.start_pc) || !read_val(config.start_mtvec) ||
+      !read_val(secure_ibex) || !read_val(icache_en) || !read_val(isa_len)) {
+    return;
+  }
+
+  config.secure_ibex = secure_ibex != 0;
+  config.icache_en = icache_en != 0;
+  config.isa_string.resize(isa_len);
+
+  header_ok = static_cast<bool>(trace.read(&config.isa_string[0], isa_len));
+}
+
+CosimTraceReader::replay_result_e CosimTraceReader::replay_record(
+    Cosim *cosim) {
+  uint8_t type;
+  if (!read_val(type)) {
+    return trace.eof() ? kReplayEnd : kReplayBadTrace;
+  }
+
+  switch (type) {
+    case kTraceAddMemory: {
+      uint32_t base_addr;
+      uint64_t size;
+      if (!read_val(base_addr) || !read_val(size)) {
+        return kReplayBadTrace;
+      }
+
+      cosim->add_memory(base_addr, size);
+      break;
+    }
+    case kTraceWriteMem: {
+      uint32_t addr, len;
+      if (!read_val(addr) || !read_val(len)) {
+        return kReplayBadTrace;
+      }
+
+      mem_buf.resize(len);
+      if (!trace.read(reinterpret_cast<char *>(mem_buf.data()), len)) {
+        return kReplayBadTrace;
+      }
+
+      cosim->backdoor_write_mem(addr, len, mem_buf.data());
+      break;
+    }
+    case kTraceStep: {
+      uint32_t write_reg_data, pc;
+      uint8_t flags;
+      if (!read_val(write_reg_data) || !read_val(pc) || !read_val(flags)) {
+        return kReplayBadTrace;
+      }
+
+      bool passed = cosim->step(flags & 0x1f, write_reg_data, pc,
+                                (flags & 0x20) != 0);
+      steps_replayed++;
+      last_step_pc = pc;
+
+      bool recorded_passed = (flags & 0x40) != 0;
+      if (!recorded_passed && recorded_failures++ == 0) {
+        first_failed_step = steps_replayed - 1;
+        first_failed_pc = pc;
+      }
+
+      if (passed != recorded_passed) {
+        return kReplayStepMismatch;
+      }
+      break;
+    }
+    case kTraceSetMip: {
+      uint32_t mip;
+      if (!read_val(mip)) {
+        return kReplayBadTrace;
+      }
+
+      cosim->set_mip(mip);
+      break;
+    }
+    case kTraceSetNmi:
+    case kTraceSetDebugReq: {
+      uint8_t val;
+      if (!read_val(val)) {
+        return kReplayBadTrace;
+      }
+
+      if (type == kTraceSetNmi) {
+        cosim->set_nmi(val != 0);
+      } else {
+        cosim->set_debug_req(val != 0);
+      }
+      break;
+    }
+    case kTraceSetMcycle: {
+      uint64_t mcycle;
+      if (!read_val(mcycle)) {
+        return kReplayBadTrace;
+      }
+
+      cosim->set_mcycle(mcycle);
+      break;
+    }
+    case kTraceDSideAccess: {
+      uint32_t addr, data;
+      uint8_t flags;
+      if (!read_val(addr) || !read_val(data) || !read_val(flags)) {
+        return kReplayBadTrace;
+      }
+
+      cosim->notify_dside_access(
+          DSideAccessInfo{.store = (flags & 0x10) != 0,
+                          .data = data,
+                          .addr = addr,
+                          .be = flags & 0xfu,
+                          .error = (flags & 0x20) != 0,
+                          .misaligned_first = (flags & 0x40) != 0,
+                          .misaligned_second = (flags & 0x80) != 0});
+      break;
+    }
+    case kTraceIsideError: {
+      uint32_t addr;
+      if (!read_val(addr)) {
+        return kReplayBadTrace;
+      }
+
+      cosim->set_iside_error(addr);
+      break;
+    }
+    case kTraceClearErrors:
+      cosim->clear_errors();
+      break;
+    default:
+      return kReplayBadTrace;
+  }
+
+  return kReplayOk;
+}
@@ -0,0 +1,156 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef COSIM_TRACE_H_
+#define COSIM_TRACE_H_
+
+#include "cosim.h"
+#include "cosim_wrapper.h"
+
+#include <stdint.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A co-simulation trace is a binary record of the calls made to a
+// co-simulator, written by `CosimTraceRecorder` and read back by
+// `CosimTraceReader`. It allows a simulation to be re-checked without the RTL
+// at ISS speed. All values are stored in host byte order.
+//
+// The trace starts with a header giving the co-simulator configuration:
+//   8 bytes   magic, "IBXCTRC1"
+//   4 bytes   start PC
+//   4 bytes   start mtvec
+//   1 byte    secure_ibex
+//   1 byte    icache_en
+//   2 bytes   length of the ISA string, followed by the ISA string
+//
+// The header is followed by records. Each record is a type byte (a
+// `cosim_trace_record_e` value) followed by the payload described below.
+typedef enum : uint8_t {
+  kTraceAddMemory,    // 4 byte base address, 8 byte size
+  kTraceWriteMem,     // 4 byte address, 4 byte length, then `length` bytes
+  kTraceStep,         // 4 byte write_reg_data, 4 byte pc, 1 byte with passed
+                      // in bit 6, sync_trap in bit 5 and write_reg in bits 4:0
+  kTraceSetMip,       // 4 byte mip
+  kTraceSetNmi,       // 1 byte nmi
+  kTraceSetDebugReq,  // 1 byte debug_req
+  kTraceSetMcycle,    // 8 byte mcycle
+  kTraceDSideAccess,  // 4 byte addr, 4 byte data, 1 byte with
+                      // misaligned_second in bit 7, misaligned_first in bit 6,
+                      // error in bit 5, store in bit 4 and be in bits 3:0
+  kTraceIsideError,   // 4 byte addr
+  kTraceClearErrors   // No payload
+} cosim_trace_record_e;
+
+// Co-simulator configuration held in a trace header, enough to construct a
+// matching SpikeCosim for replay.
+struct CosimTraceConfig {
+  std::string isa_string;
+  uint32_t start_pc;
+  uint32_t start_mtvec;
+  bool secure_ibex;
+  bool icache_en;
+};
+
+// Forwards all calls to another `Cosim` implementation, recording those that
+// affect co-simulation (memory setup and writes, `step` along with its result,
+// and the calls that feed it) to a trace file.
+//
+// `save_state` and `restore_state` are forwarded but can't be recorded, a
+// trace of a simulation that restores state won't replay correctly.
+class CosimTraceRecorder : public CosimWrapper {
+ public:
+  // `cosim` must outlive this object. Use `is_open` to check the trace file
+  // could be opened.
+  CosimTraceRecorder(Cosim *cosim, const std::string &trace_path,
+                     const CosimTraceConfig &config);
+
+  bool is_open() const { return trace.is_open(); }
+
+  // Cosim implementation, the calls not recorded are forwarded by
+  // `CosimWrapper`
+  void add_memory(uint32_t base_addr, size_t size) override;
+  bool backdoor_write_mem(uint32_t addr, size_t len,
+                          const uint8_t *data_in) override;
+  bool step(uint32_t write_reg, uint32_t write_reg_data, uint32_t pc,
+            bool sync_trap) override;
+  int step_batch(const RetireInfo *retire_info, int num_insns) override;
+  void set_mip(uint32_t mip) override;
+  void set_nmi(bool nmi) override;
+  void set_debug_req(bool debug_req) override;
+  void set_mcycle(uint64_t mcycle) override;
+  void notify_dside_access(const DSideAccessInfo &access_info) override;
+  void set_iside_error(uint32_t addr) override;
+  void clear_errors() override;
+
+ private:
+  std::ofstream trace;
+
+  template <typename T>
+  void write_val(T val) {
+    trace.write(reinterpret_cast<const char *>(&val), sizeof(T));
+  }
+
+  void write_step(uint32_t write_reg, uint32_t write_reg_data, uint32_t pc,
+                  bool sync_trap, bool passed);
+};
+
+// Reads a trace written by `CosimTraceRecorder` and replays it into a
+// co-simulator.
+class CosimTraceReader {
+ public:
+  typedef enum {
+    kReplayOk,            // Record replayed
+    kReplayStepMismatch,  // A step passed where it failed when recorded, or
+                          // vice versa
+    kReplayEnd,           // No more records
+    kReplayBadTrace       // Trace is truncated or holds an unknown record
+  } replay_result_e;
+
+  // Use `is_open` to check the trace file could be opened and has a valid
+  // header.
+  CosimTraceReader(const std::string &trace_path);
+
+  bool is_open() const { return header_ok; }
+
+  const CosimTraceConfig &get_config() const { return config; }
+
+  // Replay the next record into `cosim`
+  replay_result_e replay_record(Cosim *cosim);
+
+  // Number of `step` records replayed so far
+  uint64_t get_steps_replayed() const { return steps_replayed; }
+
+  // PC of the last `step` record replayed
+  uint32_t get_last_step_pc() const { return last_step_pc; }
+
+  // Number of `step` records replayed that failed when recorded
+  uint64_t get_recorded_failures() const { return recorded_failures; }
+
+  // Index and PC of the first `step` record replayed that failed when
+  // recorded, only valid if `get_recorded_failures` is non-zero
+  uint64_t get_first_failed_step() const { return first_failed_step; }
+  uint32_t get_first_failed_pc() const { return first_failed_pc; }
+
+ private:
+  std::ifstream trace;
+  bool header_ok;
+  CosimTraceConfig config;
+  uint64_t steps_replayed;
+  uint32_t last_step_pc;
+  uint64_t recorded_failures;
+  uint64_t first_failed_step;
+  uint32_t first_failed_pc;
+  std::vector<uint8_t> mem_buf;
+
+  template <typename T>
+  bool read_val(T &val) {
+    return static_cast<bool>(
+        trace.read(reinterpret_cast<char *>(&val), sizeof(T)));
+  }
+};
+
+#endif  // COSIM_TRACE_H_
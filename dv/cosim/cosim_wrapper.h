@@ -0,0 +1,90 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef COSIM_WRAPPER_H_
+#define COSIM_WRAPPER_H_
+
+#include "cosim.h"
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Base class for a `Cosim` implementation that wraps another one. Every call
+// is forwarded to the wrapped co-simulator, subclasses override the calls they
+// need to handle differently.
+class CosimWrapper : public Cosim {
+ public:
+  // `cosim` must outlive this object
+  CosimWrapper(Cosim *cosim) : cosim(cosim) {}
+
+  // Cosim implementation
+  void add_memory(uint32_t base_addr, size_t size) override {
+    cosim->add_memory(base_addr, size);
+  }
+
+  bool backdoor_write_mem(uint32_t addr, size_t len,
+                          const uint8_t *data_in) override {
+    return cosim->backdoor_write_mem(addr, len, data_in);
+  }
+
+  bool backdoor_read_mem(uint32_t addr, size_t len,
+                         uint8_t *data_out) override {
+    return cosim->backdoor_read_mem(addr, len, data_out);
+  }
+
+  bool step(uint32_t write_reg, uint32_t write_reg_data, uint32_t pc,
+            bool sync_trap) override {
+    return cosim->step(write_reg, write_reg_data, pc, sync_trap);
+  }
+
+  int step_batch(const RetireInfo *retire_info, int num_insns) override {
+    return cosim->step_batch(retire_info, num_insns);
+  }
+
+  void set_mip(uint32_t mip) override { cosim->set_mip(mip); }
+  void set_nmi(bool nmi) override { cosim->set_nmi(nmi); }
+  void set_debug_req(bool debug_req) override {
+    cosim->set_debug_req(debug_req);
+  }
+  void set_mcycle(uint64_t mcycle) override { cosim->set_mcycle(mcycle); }
+
+  void notify_dside_access(const DSideAccessInfo &access_info) override {
+    cosim->notify_dside_access(access_info);
+  }
+
+  void set_iside_error(uint32_t addr) override {
+    cosim->set_iside_error(addr);
+  }
+
+  const std::vector<std::string> &get_errors() override {
+    return cosim->get_errors();
+  }
+
+  void clear_errors() override { cosim->clear_errors(); }
+  int get_insn_cnt() override { return cosim->get_insn_cnt(); }
+
+  // DPI calls are made with the outermost co-simulator as the handle, so are
+  // counted by the wrapper rather than the wrapped co-simulator
+  CosimStats get_stats() override {
+    CosimStats stats = cosim->get_stats();
+    stats.dpi_calls += num_dpi_calls;
+
+    return stats;
+  }
+
+  std::shared_ptr<CosimState> save_state() override {
+    return cosim->save_state();
+  }
+
+  bool restore_state(const std::shared_ptr<CosimState> &state) override {
+    return cosim->restore_state(state);
+  }
+
+ protected:
+  Cosim *cosim;
+};
+
+#endif  // COSIM_WRAPPER_H_
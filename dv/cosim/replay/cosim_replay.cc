@@ -0,0 +1,110 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+// Replays a co-simulation trace (see cosim_trace.h) into SpikeCosim without
+// any RTL, reporting the first instruction whose checking result differs from
+// the one recorded. Exits non-zero on a difference or if the recorded run
+// failed checking.
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "cosim_trace.h"
+#include "spike_cosim.h"
+
+static void print_usage(const char *prog) {
+  std::cerr << "Usage: " << prog
+            << " [--log=FILE] [--direct-fetch] TRACE_FILE" << std::endl
+            << std::endl
+            << "  --log=FILE      Write a spike trace log to FILE" << std::endl
+            << "  --direct-fetch  Serve instruction fetches directly from "
+               "spike memory"
+            << std::endl;
+}
+
+int main(int argc, char **argv) {
+  std::string trace_path;
+  std::string log_path;
+  bool direct_fetch = false;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--log=", 6) == 0) {
+      log_path = argv[i] + 6;
+    } else if (strcmp(argv[i], "--direct-fetch") == 0) {
+      direct_fetch = true;
+    } else if (argv[i][0] != '-' && trace_path.empty()) {
+      trace_path = argv[i];
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (trace_path.empty()) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  CosimTraceReader reader(trace_path);
+  if (!reader.is_open()) {
+    std::cerr << "ERROR: Could not read a co-simulation trace from "
+              << trace_path << std::endl;
+    return 1;
+  }
+
+  const CosimTraceConfig &config = reader.get_config();
+  std::cout << "Replaying " << trace_path << " with ISA " << config.isa_string
+            << std::endl;
+
+  auto cosim = std::make_unique<SpikeCosim>(
+      config.isa_string, config.start_pc, config.start_mtvec, log_path,
+      config.secure_ibex, config.icache_en);
+  cosim->set_direct_fetch(direct_fetch);
+
+  CosimTraceReader::replay_result_e result;
+  while ((result = reader.replay_record(cosim.get())) ==
+         CosimTraceReader::kReplayOk) {
+  }
+
+  if (result == CosimTraceReader::kReplayBadTrace) {
+    std::cerr << "ERROR: Trace is truncated or corrupt after "
+              << reader.get_steps_replayed() << " instructions" << std::endl;
+    return 1;
+  }
+
+  if (result == CosimTraceReader::kReplayStepMismatch) {
+    std::cout << "FAILURE: Checking result differs from the recorded result "
+              << "at instruction " << reader.get_steps_replayed() - 1
+              << " (DUT PC: " << std::hex << reader.get_last_step_pc()
+              << std::dec << ")" << std::endl;
+
+    for (const std::string &error : cosim->get_errors()) {
+      std::cout << error << std::endl;
+    }
+
+    return 1;
+  }
+
+  std::cout << "Replayed " << reader.get_steps_replayed()
+            << " instructions, all checking results matched the recording"
+            << std::endl;
+
+  // The replay reproduced the recording, which may itself have failed
+  if (reader.get_recorded_failures() != 0) {
+    std::cout << "FAILURE: Recorded run failed checking at instruction "
+              << reader.get_first_failed_step()
+              << " (DUT PC: " << std::hex << reader.get_first_failed_pc()
+              << std::dec << ")" << std::endl;
+
+    for (const std::string &error : cosim->get_errors()) {
+      std::cout << error << std::endl;
+    }
+
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,83 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef RING_BUFFER_H_
+#define RING_BUFFER_H_
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+// FIFO queue held in a circular buffer. Removing from the front is constant
+// time and storage is only allocated when the queue grows beyond its previous
+// largest size, so a queue that stays small never allocates after
+// construction.
+template <typename T>
+class RingBuffer {
+ public:
+  // `initial_capacity` must be a power of two
+  explicit RingBuffer(size_t initial_capacity = 16)
+      : buf(initial_capacity), head(0), count(0) {
+    assert((initial_capacity != 0) &&
+           ((initial_capacity & (initial_capacity - 1)) == 0));
+  }
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  T &front() {
+    assert(count != 0);
+    return buf[head];
+  }
+
+  // Element `idx` places from the front of the queue
+  T &operator[](size_t idx) {
+    assert(idx < count);
+    return buf[(head + idx) & (buf.size() - 1)];
+  }
+
+  const T &operator[](size_t idx) const {
+    assert(idx < count);
+    return buf[(head + idx) & (buf.size() - 1)];
+  }
+
+  void push_back(const T &item) {
+    if (count == buf.size()) {
+      grow();
+    }
+
+    buf[(head + count) & (buf.size() - 1)] = item;
+    ++count;
+  }
+
+  void pop_front() {
+    assert(count != 0);
+    head = (head + 1) & (buf.size() - 1);
+    --count;
+  }
+
+  void clear() {
+    head = 0;
+    count = 0;
+  }
+
+ private:
+  std::vector<T> buf;
+  size_t head;
+  size_t count;
+
+  // Double the capacity, moving the queue to the start of the new buffer
+  void grow() {
+    std::vector<T> new_buf(buf.size() * 2);
+
+    for (size_t i = 0; i < count; ++i) {
+      new_buf[i] = (*this)[i];
+    }
+
+    buf.swap(new_buf);
+    head = 0;
+  }
+};
+
+#endif  // RING_BUFFER_H_
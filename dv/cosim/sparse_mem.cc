@@ -0,0 +1,87 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "sparse_mem.h"
+
+#include <algorithm>
+#include <cstring>
+
+static bool all_zero(const uint8_t *bytes, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    if (bytes[i] != 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+SparseMem::SparseMem(reg_t size) : sz(size) {}
+
+bool SparseMem::load(reg_t addr, size_t len, uint8_t *bytes) {
+  if (addr + len < addr || addr + len > sz) {
+    return false;
+  }
+
+  while (len > 0) {
+    reg_t page_num = addr / PGSIZE;
+    reg_t page_offset = addr % PGSIZE;
+    size_t chunk_len = std::min<size_t>(len, PGSIZE - page_offset);
+
+    auto page = pages.find(page_num);
+    if (page == pages.end()) {
+      memset(bytes, 0, chunk_len);
+    } else {
+      memcpy(bytes, page->second->data + page_offset, chunk_len);
+    }
+
+    addr += chunk_len;
+    bytes += chunk_len;
+    len -= chunk_len;
+  }
+
+  return true;
+}
+
+bool SparseMem::store(reg_t addr, size_t len, const uint8_t *bytes) {
+  if (addr + len < addr || addr + len > sz) {
+    return false;
+  }
+
+  while (len > 0) {
+    reg_t page_num = addr / PGSIZE;
+    reg_t page_offset = addr % PGSIZE;
+    size_t chunk_len = std::min<size_t>(len, PGSIZE - page_offset);
+
+    // Writing zeros to a page that was never allocated leaves it unchanged, so
+    // there's no need to allocate it. This keeps loading an image that
+    // includes large zeroed regions cheap.
+    if (pages.count(page_num) || !all_zero(bytes, chunk_len)) {
+      memcpy(get_page_for_write(page_num)->data + page_offset, bytes,
+             chunk_len);
+    }
+
+    addr += chunk_len;
+    bytes += chunk_len;
+    len -= chunk_len;
+  }
+
+  return true;
+}
+
+char *SparseMem::contents(reg_t addr) {
+  return reinterpret_cast<char *>(get_page_for_write(addr / PGSIZE)->data +
+                                  addr % PGSIZE);
+}
+
+SparseMem::Page *SparseMem::get_page_for_write(reg_t page_num) {
+  auto &page = pages[page_num];
+
+  if (!page) {
+    // make_unique value-initialises the page, so it starts zeroed
+    page = std::make_unique<Page>();
+  }
+
+  return page.get();
+}
@@ -0,0 +1,43 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef SPARSE_MEM_H_
+#define SPARSE_MEM_H_
+
+#include "riscv/devices.h"
+
+#include <stdint.h>
+#include <memory>
+#include <unordered_map>
+
+// Memory device for spike that only allocates storage for pages that have been
+// written with non-zero data. Unallocated pages read as zero.
+class SparseMem : public abstract_device_t {
+ public:
+  explicit SparseMem(reg_t size);
+
+  bool load(reg_t addr, size_t len, uint8_t *bytes) override;
+  bool store(reg_t addr, size_t len, const uint8_t *bytes) override;
+
+  reg_t size() const { return sz; }
+
+  // Return a pointer to the byte at `addr` which may be used to read or write
+  // the rest of its page directly. The page is allocated if it hasn't been
+  // written. The pointer remains valid until the memory is destroyed.
+  char *contents(reg_t addr);
+
+ private:
+  struct Page {
+    uint8_t data[PGSIZE];
+  };
+
+  reg_t sz;
+  // Pages that have been written, keyed by page number
+  std::unordered_map<reg_t, std::unique_ptr<Page>> pages;
+
+  // Return a page that can be written, allocating it if required
+  Page *get_page_for_write(reg_t page_num);
+};
+
+#endif  // SPARSE_MEM_H_
@@ -7,10 +7,14 @@
 #include "riscv/decode.h"
 #include "riscv/devices.h"
 #include "riscv/log_file.h"
+#include "riscv/mmu.h"
 #include "riscv/processor.h"
 #include "riscv/simif.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 
@@ -31,10 +35,143 @@
 #include "riscv/isa_parser.h"
 #endif
 
+static const uint32_t kMretInsn = 0x30200073;
+
+// Return the GPR written by `insn` (which may be compressed) or 0 if it writes
+// none. Only RV32IMCB instructions implemented by Ibex need to be handled.
+static uint32_t insn_gpr_dest(uint32_t insn) {
+  uint32_t rd = (insn >> 7) & 0x1f;
+
+  switch (insn & 0x3) {
+    case 0x0:
+      // C.ADDI4SPN and C.LW write rd'
+      switch ((insn >> 13) & 0x7) {
+        case 0x0:
+        case 0x2:
+          return 8 + ((insn >> 2) & 0x7);
+        default:
+          return 0;
+      }
+    case 0x1:
+      switch ((insn >> 13) & 0x7) {
+        case 0x0:  // C.ADDI
+        case 0x2:  // C.LI
+        case 0x3:  // C.LUI / C.ADDI16SP
+          return rd;
+        case 0x1:  // C.JAL
+          return 1;
+        case 0x4:  // C.SRLI, C.SRAI, C.ANDI, C.SUB, C.XOR, C.OR, C.AND
+          return 8 + ((insn >> 7) & 0x7);
+        default:  // C.J, C.BEQZ, C.BNEZ
+          return 0;
+      }
+    case 0x2:
+      switch ((insn >> 13) & 0x7) {
+        case 0x0:  // C.SLLI
+        case 0x2:  // C.LWSP
+          return rd;
+        case 0x4:
+          if (((insn >> 2) & 0x1f) != 0) {
+            // C.MV / C.ADD
+            return rd;
+          }
+          // C.JALR writes ra, C.JR and C.EBREAK write nothing
+          return ((insn >> 12) & 0x1) && rd != 0 ? 1 : 0;
+        default:
+          return 0;
+      }
+    default:
+      break;
+  }
+
+  switch (insn & 0x7f) {
+    case 0x37:  // LUI
+    case 0x17:  // AUIPC
+    case 0x6f:  // JAL
+    case 0x67:  // JALR
+    case 0x03:  // LOAD
+    case 0x13:  // OP-IMM
+    case 0x33:  // OP
+      return rd;
+    case 0x73:  // SYSTEM, only the CSR instructions write a GPR
+      return ((insn >> 12) & 0x7) != 0 ? rd : 0;
+    default:
+      return 0;
+  }
+}
+
+// Return true if `insn` (which may be compressed) accesses data memory. Loads
+// and stores of every width are included, whether or not Ibex implements them.
+static bool insn_is_mem_access(uint32_t insn) {
+  switch (insn & 0x3) {
+    case 0x0:
+      // Everything other than C.ADDI4SPN
+      return ((insn >> 13) & 0x7) != 0x0;
+    case 0x1:
+      return false;
+    case 0x2:
+      // C.LWSP, C.SWSP and the floating point equivalents
+      switch ((insn >> 13) & 0x7) {
+        case 0x0:
+        case 0x4:
+          return false;
+        default:
+          return true;
+      }
+    default:
+      break;
+  }
+
+  switch (insn & 0x7f) {
+    case 0x03:  // LOAD
+    case 0x07:  // LOAD-FP
+    case 0x23:  // STORE
+    case 0x27:  // STORE-FP
+    case 0x2f:  // AMO
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Return true if `insn` is a Zicsr instruction that writes a CSR, with the CSR
+// written in `csr`. CSRRS and CSRRC (and their immediate forms) with rs1/uimm
+// of 0 only read the CSR.
+static bool insn_csr_dest(uint32_t insn, uint32_t &csr) {
+  if ((insn & 0x7f) != 0x73) {
+    return false;
+  }
+
+  uint32_t funct3 = (insn >> 12) & 0x7;
+  uint32_t rs1 = (insn >> 15) & 0x1f;
+
+  switch (funct3 & 0x3) {
+    case 0x1:  // CSRRW / CSRRWI
+      break;
+    case 0x2:  // CSRRS / CSRRSI
+    case 0x3:  // CSRRC / CSRRCI
+      if (rs1 == 0) {
+        return false;
+      }
+      break;
+    default:  // ECALL, EBREAK, MRET, WFI etc.
+      return false;
+  }
+
+  csr = insn >> 20;
+  return true;
+}
+
 SpikeCosim::SpikeCosim(const std::string &isa_string, uint32_t start_pc,
                        uint32_t start_mtvec, const std::string &trace_log_path,
                        bool secure_ibex, bool icache_en)
-    : nmi_mode(false), pending_iside_error(false) {
+    : nmi_mode(false),
+      pending_iside_error(false),
+      direct_fetch(false),
+      fast_forwarding(false),
+      num_reg_writes(0),
+      insn_cnt(0),
+      stats() {
   FILE *log_file = nullptr;
   if (trace_log_path.length() != 0) {
     log = std::make_unique<log_file_t>(trace_log_path.c_str());
@@ -62,10 +199,81 @@ SpikeCosim::SpikeCosim(const std::string &isa_string, uint32_t start_pc,
     processor->set_debug(true);
     processor->enable_log_commits();
   }
+
+  // Reserve space up front so recording errors doesn't allocate
+  error_records.reserve(16);
+}
+
+void SpikeCosim::set_direct_fetch(bool en) {
+  direct_fetch = en;
+
+  // Drop any cached translations so nothing fetched under the old setting is
+  // used under the new one
+  processor->get_mmu()->flush_tlb();
+  processor->get_mmu()->flush_icache();
 }
 
-// always return nullptr so all memory accesses go via mmio_load/mmio_store
-char *SpikeCosim::addr_to_mem(reg_t addr) { return nullptr; }
+char *SpikeCosim::addr_to_mem(reg_t addr) {
+  // Without direct fetch always return nullptr so all memory accesses go via
+  // mmio_load/mmio_store
+  if (!direct_fetch && !fast_forwarding) {
+    return nullptr;
+  }
+
+  // Spike doesn't say whether this is a fetch or a data access, and caches the
+  // returned pointer for the whole page for the kind of access it made. A data
+  // access served here would take the page out of dside checking (and
+  // copy-on-write tracking) for every later access, so only a fetch may be
+  // given a pointer. Fetches are within 8 bytes of the PC, as in mmio_load.
+  // A data access can only fall in that range if the instruction at the PC is
+  // a load or store, in which case return nullptr so whichever access this is
+  // goes via mmio_load/mmio_store; a later fetch from the page can still be
+  // served directly. Nothing is checked when fast forwarding so any access can
+  // be served directly.
+  if (!fast_forwarding) {
+    uint32_t pc = processor->get_state()->pc;
+    if (addr < pc || addr >= (pc + 8)) {
+      return nullptr;
+    }
+
+    uint32_t insn;
+    if (!read_insn(pc, insn) || insn_is_mem_access(insn)) {
+      return nullptr;
+    }
+  }
+
+  // Iside errors are produced in mmio_load
+  if (pending_iside_error &&
+      ((addr & 0xfffffffc) == pending_iside_err_addr)) {
+    return nullptr;
+  }
+
+  // Spike will use the returned pointer for every fetch from the same page, so
+  // the whole page must be backed by the memory.
+  auto desc = bus.find_device(addr);
+  reg_t mem_offset = addr - desc.first;
+  reg_t page_offset = mem_offset & ~(reg_t)(PGSIZE - 1);
+
+  auto mem = dynamic_cast<SparseMem *>(desc.second);
+  if (!mem) {
+    return nullptr;
+  }
+
+  // Sparse memory pages are only contiguous within a page of the memory, which
+  // is only a spike page if the memory is page aligned.
+  if (((desc.first & (PGSIZE - 1)) != 0) ||
+      (page_offset + PGSIZE > mem->size())) {
+    return nullptr;
+  }
+
+  // Spike may write through the returned pointer when fast forwarding, so the
+  // page must be saved as for any other write
+  if (fast_forwarding) {
+    save_mem_pages(desc.first + page_offset, PGSIZE);
+  }
+
+  return mem->contents(mem_offset);
+}
 
 bool SpikeCosim::mmio_load(reg_t addr, size_t len, uint8_t *bytes) {
   bool bus_error = !bus.load(addr, len, bytes);
@@ -77,6 +285,17 @@ bool SpikeCosim::mmio_load(reg_t addr, size_t len, uint8_t *bytes) {
   uint32_t pc = processor->get_state()->pc;
   uint32_t aligned_addr = addr & 0xfffffffc;
 
+  if (fast_forwarding) {
+    // There's no DUT access to check against or take data from, data
+    // accesses outside of co-simulator memory read as zero.
+    if (bus_error && (addr < pc || addr >= (pc + 8))) {
+      memset(bytes, 0, len);
+      return true;
+    }
+
+    return !bus_error;
+  }
+
   if (pending_iside_error && (aligned_addr == pending_iside_err_addr)) {
     // Check if the incoming access is subject to an iside error, in which case
     // assume it's an iside access and produce an error.
@@ -92,17 +311,26 @@ bool SpikeCosim::mmio_load(reg_t addr, size_t len, uint8_t *bytes) {
     // true, otherwise assume a dside access and check against DUT dside
     // accesses.  If the RTL produced a bus error for the access, or the
     // checking failed produce a memory fault in spike.
-    dut_error = (check_mem_access(false, addr, len, bytes) != kCheckMemOk);
+    dut_error =
+        (timed_check_mem_access(false, addr, len, bytes) != kCheckMemOk);
   }
 
   return !(bus_error || dut_error);
 }
 
 bool SpikeCosim::mmio_store(reg_t addr, size_t len, const uint8_t *bytes) {
+  save_mem_pages(addr, len);
   bool bus_error = !bus.store(addr, len, bytes);
+
+  // Stores outside of co-simulator memory are dropped when fast forwarding
+  if (fast_forwarding) {
+    return true;
+  }
+
   // If the RTL produced a bus error for the access, or the checking failed
   // produce a memory fault in spike.
-  bool dut_error = (check_mem_access(true, addr, len, bytes) != kCheckMemOk);
+  bool dut_error =
+      (timed_check_mem_access(true, addr, len, bytes) != kCheckMemOk);
 
   return !(bus_error || dut_error);
 }
@@ -112,13 +340,20 @@ void SpikeCosim::proc_reset(unsigned id) {}
 const char *SpikeCosim::get_symbol(uint64_t addr) { return nullptr; }
 
 void SpikeCosim::add_memory(uint32_t base_addr, size_t size) {
-  auto new_mem = std::make_unique<mem_t>(size);
+  // Memory is sparse so only pages that are written use any host memory
+  auto new_mem = std::make_unique<SparseMem>(size);
   bus.add_device(base_addr, new_mem.get());
   mems.emplace_back(std::move(new_mem));
 }
 
 bool SpikeCosim::backdoor_write_mem(uint32_t addr, size_t len,
                                     const uint8_t *data_in) {
+  // The write may change instructions spike has already decoded
+  if (direct_fetch) {
+    processor->get_mmu()->flush_icache();
+  }
+
+  save_mem_pages(addr, len);
   return bus.store(addr, len, data_in);
 }
 
@@ -129,55 +364,75 @@ bool SpikeCosim::backdoor_read_mem(uint32_t addr, size_t len,
 
 bool SpikeCosim::step(uint32_t write_reg, uint32_t write_reg_data, uint32_t pc,
                       bool sync_trap) {
+  if (check_step(write_reg, write_reg_data, pc, sync_trap)) {
+    return true;
+  }
+
+  // Identify the failing instruction ahead of the errors describing it, so a
+  // caller checking many instructions at once can report it. Only the first
+  // failure is identified; records already formatted by `get_errors` can't be
+  // moved so it goes last in that case.
+  bool identified = false;
+  for (const ErrorRecord &error : error_records) {
+    identified |= error.code == kErrStepFailed;
+  }
+
+  if (!identified) {
+    ErrorRecord failed{.code = kErrStepFailed,
+                       .vals = {static_cast<uint64_t>(insn_cnt), pc}};
+    if (errors.empty()) {
+      error_records.insert(error_records.begin(), failed);
+    } else {
+      error_records.push_back(failed);
+    }
+  }
+
+  return false;
+}
+
+bool SpikeCosim::check_step(uint32_t write_reg, uint32_t write_reg_data,
+                            uint32_t pc, bool sync_trap) {
   assert(write_reg < 32);
 
   uint32_t initial_pc = (processor->get_state()->pc & 0xffffffff);
   bool initial_pc_match = initial_pc == pc;
 
+  stats.insns_stepped++;
+
   // Execute the next instruction
-  processor->step(1);
+  timed_proc_step();
 
   if (processor->get_state()->last_inst_pc == PC_INVALID) {
     if (processor->get_state()->mcause->read() & 0x80000000) {
       // Interrupt occurred, step again to execute first instruction of
       // interrupt
-      processor->step(1);
+      timed_proc_step();
       // TODO: Deal with exception on first instruction of interrupt
       assert(processor->get_state()->last_inst_pc != PC_INVALID);
     } else {
       // Otherwise a synchronous trap has occurred, check the DUT reported a
       // synchronous trap at the same point
       if (!sync_trap) {
-        std::stringstream err_str;
-        err_str << "Synchronous trap was expected at ISS PC: " << std::hex
-                << processor->get_state()->pc
-                << " but DUT didn't report one at PC " << pc;
-        errors.emplace_back(err_str.str());
+        add_error(kErrSyncTrapNotSeen, processor->get_state()->pc, pc);
 
         return false;
       }
 
       if (!initial_pc_match) {
-        std::stringstream err_str;
-        err_str << "PC mismatch at synchronous trap, DUT: " << std::hex << pc
-                << " expected: " << std::hex << initial_pc;
-        errors.emplace_back(err_str.str());
+        add_error(kErrSyncTrapPcMismatch, pc, initial_pc);
 
         return false;
       }
 
       if (write_reg != 0) {
-        std::stringstream err_str;
-        err_str << "Synchronous trap occurred at PC: " << std::hex << pc
-                << "but DUT wrote to register: x" << std::dec << write_reg;
-        errors.emplace_back(err_str.str());
+        add_error(kErrSyncTrapRegWrite, pc, write_reg);
 
         return false;
       }
 
       // Errors may have been generated outside of step() (e.g. in
       // check_mem_access()), return false if there are any.
-      return errors.size() == 0;
+      return error_records.empty();
     }
   }
 
@@ -185,66 +440,51 @@ bool SpikeCosim::step(uint32_t write_reg, uint32_t write_reg_data, uint32_t pc,
   // TODO: Confirm details of why spike sign extends PC, something to do with
   // 32-bit address as 64-bit address must be sign extended?
   if ((processor->get_state()->last_inst_pc & 0xffffffff) != pc) {
-    std::stringstream err_str;
-    err_str << "PC mismatch, DUT: " << std::hex << pc
-            << " expected: " << std::hex
-            << processor->get_state()->last_inst_pc;
-    errors.emplace_back(err_str.str());
+    add_error(kErrPcMismatch, pc, processor->get_state()->last_inst_pc);
 
     return false;
   }
 
-  if (!sync_trap && pc_is_mret(pc) && nmi_mode) {
+  uint32_t insn = 0;
+  bool insn_valid = read_insn(pc, insn);
+
+  if (!sync_trap && nmi_mode && insn_valid && insn == kMretInsn) {
     // Do handling for recoverable NMI
     leave_nmi_mode();
   }
 
   // Check register writes from executed instruction match what is expected
-  auto &reg_changes = processor->get_state()->log_reg_write;
+  if (insn_valid) {
+    capture_reg_writes(insn);
+  } else {
+    num_reg_writes = 0;
+  }
 
   bool gpr_write_seen = false;
 
-  for (auto reg_change : reg_changes) {
-    // reg_change.first provides register type in bottom 4 bits, then register
-    // index above that
-
-    // Ignore writes to x0
-    if (reg_change.first == 0)
-      continue;
+  for (int i = 0; i < num_reg_writes; ++i) {
+    const RegWrite &reg_write = reg_writes[i];
 
-    if ((reg_change.first & 0xf) == 0) {
-      // register is GPR
-      // should never see more than one GPR write per step
-      assert(!gpr_write_seen);
-
-      if (!check_gpr_write(reg_change, write_reg, write_reg_data)) {
+    if (reg_write.csr) {
+      on_csr_write(reg_write.index, reg_write.data);
+    } else {
+      if (!check_gpr_write(reg_write.index, reg_write.data, write_reg,
+                           write_reg_data)) {
         return false;
       }
 
       gpr_write_seen = true;
-    } else if ((reg_change.first & 0xf) == 4) {
-      // register is CSR
-      on_csr_write(reg_change);
-    } else {
-      // should never see other types
-      assert(false);
     }
   }
 
   if (write_reg != 0 && !gpr_write_seen) {
-    std::stringstream err_str;
-    err_str << "DUT wrote register x" << write_reg
-            << " but a write was not expected" << std::endl;
-    errors.emplace_back(err_str.str());
+    add_error(kErrUnexpectedRegWrite, write_reg);
 
     return false;
   }
 
   if (pending_iside_error) {
-    std::stringstream err_str;
-    err_str << "DUT generated an iside error for address: " << std::hex
-            << pending_iside_err_addr << " but the ISS didn't produce one";
-    errors.emplace_back(err_str.str());
+    add_error(kErrIsideErrorNotSeen, pending_iside_err_addr);
 
     return false;
   }
@@ -254,7 +494,7 @@ bool SpikeCosim::step(uint32_t write_reg, uint32_t write_reg_data, uint32_t pc,
   // Errors may have been generated outside of step() (e.g. in
   // check_mem_access()). Only increment insn_cnt and return true if there are
   // no errors
-  if (errors.size() == 0) {
+  if (error_records.empty()) {
     insn_cnt++;
     return true;
   }
@@ -262,39 +502,57 @@ bool SpikeCosim::step(uint32_t write_reg, uint32_t write_reg_data, uint32_t pc,
   return false;
 }
 
-bool SpikeCosim::check_gpr_write(const commit_log_reg_t::value_type &reg_change,
-                                 uint32_t write_reg, uint32_t write_reg_data) {
-  uint32_t cosim_write_reg = (reg_change.first >> 4) & 0x1f;
+void SpikeCosim::timed_proc_step() {
+  auto start = std::chrono::steady_clock::now();
+  processor->step(1);
+  stats.step_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+}
+
+void SpikeCosim::capture_reg_writes(uint32_t insn) {
+  num_reg_writes = 0;
+
+  uint32_t gpr_dest = insn_gpr_dest(insn);
+
+  // Writes to x0 are ignored
+  if (gpr_dest != 0) {
+    // TODO: Investigate why spike can produce values with high 32 bits set
+    // (may be because spike can produce PCs with high 32 bits set).
+    reg_writes[num_reg_writes++] = {
+        false, gpr_dest,
+        static_cast<uint32_t>(processor->get_state()->XPR[gpr_dest])};
+  }
 
+  // Only the CSR named by a CSR instruction counts as written. CSRs changed as
+  // a side effect (e.g. mstatus on trap entry or MRET) were not written by
+  // the instruction and need no fixup.
+  uint32_t csr_dest;
+  if (insn_csr_dest(insn, csr_dest)) {
+    reg_writes[num_reg_writes++] = {true, csr_dest,
+                                    static_cast<uint32_t>(
+                                        processor->get_csr(csr_dest))};
+  }
+}
+
+bool SpikeCosim::check_gpr_write(uint32_t cosim_write_reg,
+                                 uint32_t cosim_write_reg_data,
+                                 uint32_t write_reg, uint32_t write_reg_data) {
   if (write_reg == 0) {
-    std::stringstream err_str;
-    err_str << "DUT didn't write to register x" << cosim_write_reg
-            << ", but a write was expected";
-    errors.emplace_back(err_str.str());
+    add_error(kErrRegWriteNotSeen, cosim_write_reg);
 
     return false;
   }
 
   if (write_reg != cosim_write_reg) {
-    std::stringstream err_str;
-    err_str << "Register write index mismatch, DUT: x" << write_reg
-            << " expected: x" << cosim_write_reg;
-    errors.emplace_back(err_str.str());
+    add_error(kErrRegWriteIdxMismatch, write_reg, cosim_write_reg);
 
     return false;
   }
 
-  // TODO: Investigate why this fails (may be because spike can produce PCs
-  // with high 32 bits set).
-  // assert((reg_change.second.v[0] & 0xffffffff00000000) == 0);
-  uint32_t cosim_write_reg_data = reg_change.second.v[0];
-
   if (write_reg_data != cosim_write_reg_data) {
-    std::stringstream err_str;
-    err_str << "Register write data mismatch to x" << cosim_write_reg
-            << " DUT: " << std::hex << write_reg_data
-            << " expected: " << cosim_write_reg_data;
-    errors.emplace_back(err_str.str());
+    add_error(kErrRegWriteDataMismatch, cosim_write_reg, write_reg_data,
+              cosim_write_reg_data);
 
     return false;
   }
@@ -302,14 +560,8 @@ bool SpikeCosim::check_gpr_write(const commit_log_reg_t::value_type &reg_change,
   return true;
 }
 
-void SpikeCosim::on_csr_write(const commit_log_reg_t::value_type &reg_change) {
-  int cosim_write_csr = (reg_change.first >> 4) & 0xfff;
-
-  // TODO: Investigate why this fails (may be because spike can produce PCs
-  // with high 32 bits set).
-  // assert((reg_change.second.v[0] & 0xffffffff00000000) == 0);
-  uint32_t cosim_write_csr_data = reg_change.second.v[0];
-
+void SpikeCosim::on_csr_write(int cosim_write_csr,
+                              uint32_t cosim_write_csr_data) {
   // Spike and Ibex have different WARL behaviours so after any CSR write
   // check the fields and adjust to match Ibex behaviour.
   fixup_csr(cosim_write_csr, cosim_write_csr_data);
@@ -370,8 +622,12 @@ void SpikeCosim::notify_dside_access(const DSideAccessInfo &access_info) {
   // Address must be 32-bit aligned
   assert((access_info.addr & 0x3) == 0);
 
-  pending_dside_accesses.emplace_back(
-      PendingMemAccess{.dut_access_info = access_info, .be_spike = 0});
+  pending_dside_accesses.push_back(
+      PendingMemAccess{.dut_access_info = access_info,
+                       .be_spike = 0,
+                       .data_spike = 0,
+                       .data_checked = false});
+  stats.dside_accesses_notified++;
 }
 
 void SpikeCosim::set_iside_error(uint32_t addr) {
@@ -380,11 +636,153 @@ void SpikeCosim::set_iside_error(uint32_t addr) {
 
   pending_iside_error = true;
   pending_iside_err_addr = addr;
+
+  // Spike may already have a direct pointer to the failing address cached, in
+  // which case the fetch wouldn't reach mmio_load to produce the error.
+  if (direct_fetch) {
+    processor->get_mmu()->flush_tlb();
+    processor->get_mmu()->flush_icache();
+  }
+}
+
+void SpikeCosim::add_error(cosim_error_e code, uint64_t val0, uint64_t val1,
+                           uint64_t val2, uint64_t val3, uint64_t val4) {
+  error_records.push_back(
+      ErrorRecord{.code = code, .vals = {val0, val1, val2, val3, val4}});
 }
 
-const std::vector<std::string> &SpikeCosim::get_errors() { return errors; }
+std::string SpikeCosim::format_error(const ErrorRecord &error) const {
+  const uint64_t *vals = error.vals;
+  std::stringstream err_str;
+
+  switch (error.code) {
+    case kErrSyncTrapNotSeen:
+      // vals: ISS PC, DUT PC
+      err_str << "Synchronous trap was expected at ISS PC: " << std::hex
+              << vals[0] << " but DUT didn't report one at PC " << vals[1];
+      break;
+    case kErrSyncTrapPcMismatch:
+      // vals: DUT PC, ISS PC
+      err_str << "PC mismatch at synchronous trap, DUT: " << std::hex
+              << vals[0] << " expected: " << std::hex << vals[1];
+      break;
+    case kErrSyncTrapRegWrite:
+      // vals: DUT PC, DUT write register
+      err_str << "Synchronous trap occurred at PC: " << std::hex << vals[0]
+              << "but DUT wrote to register: x" << std::dec << vals[1];
+      break;
+    case kErrPcMismatch:
+      // vals: DUT PC, ISS PC
+      err_str << "PC mismatch, DUT: " << std::hex << vals[0]
+              << " expected: " << std::hex << vals[1];
+      break;
+    case kErrUnexpectedRegWrite:
+      // vals: DUT write register
+      err_str << "DUT wrote register x" << vals[0]
+              << " but a write was not expected" << std::endl;
+      break;
+    case kErrIsideErrorNotSeen:
+      // vals: iside error address
+      err_str << "DUT generated an iside error for address: " << std::hex
+              << vals[0] << " but the ISS didn't produce one";
+      break;
+    case kErrRegWriteNotSeen:
+      // vals: ISS write register
+      err_str << "DUT didn't write to register x" << vals[0]
+              << ", but a write was expected";
+      break;
+    case kErrRegWriteIdxMismatch:
+      // vals: DUT write register, ISS write register
+      err_str << "Register write index mismatch, DUT: x" << vals[0]
+              << " expected: x" << vals[1];
+      break;
+    case kErrRegWriteDataMismatch:
+      // vals: register, DUT data, ISS data
+      err_str << "Register write data mismatch to x" << vals[0]
+              << " DUT: " << std::hex << vals[1] << " expected: " << vals[2];
+      break;
+    case kErrMemNoPendingAccess:
+      // vals: ISS store, ISS address
+      err_str << "A " << (vals[0] ? "store" : "load") << " at address "
+              << std::hex << vals[1]
+              << " was expected but there are no pending accesses";
+      break;
+    case kErrMemAddrMismatch:
+      // vals: ISS store, DUT store, DUT address, ISS aligned address
+      err_str << "DUT generated " << (vals[1] ? "store" : "load")
+              << " at address " << std::hex << vals[2] << " but "
+              << (vals[0] ? "store" : "load") << " at address " << vals[3]
+              << " was expected";
+      break;
+    case kErrMemTypeMismatch:
+      // vals: ISS store, DUT store, DUT address
+      err_str << "DUT generated " << (vals[1] ? "store" : "load")
+              << " at addr " << std::hex << vals[2] << " but a "
+              << (vals[0] ? "store" : "load") << " was expected";
+      break;
+    case kErrMemMisalignedBeRepeated:
+      // vals: DUT store, DUT address, DUT BE, ISS BE, ISS BE seen so far
+      err_str << "DUT generated " << (vals[0] ? "store" : "load")
+              << " at address " << std::hex << vals[1] << " with BE "
+              << vals[2] << " and expected BE " << vals[3]
+              << " has been seen twice, so far seen " << vals[4];
+      break;
+    case kErrMemMisalignedBeExtra:
+      // vals: DUT store, DUT address, DUT BE, ISS BE
+      err_str << "DUT generated " << (vals[0] ? "store" : "load")
+              << " at address " << std::hex << vals[1] << " with BE "
+              << vals[2] << " but expected BE " << vals[3]
+              << " has other bytes enabled";
+      break;
+    case kErrMemBeMismatch:
+      // vals: DUT store, DUT address, DUT BE, ISS BE
+      err_str << "DUT generated " << (vals[0] ? "store" : "load")
+              << " at address " << std::hex << vals[1] << " with BE "
+              << vals[2] << " but BE " << vals[3] << " was expected";
+      break;
+    case kErrMemDataMismatch:
+      // vals: ISS store, DUT address, DUT data, ISS data, ISS BE
+      err_str << "DUT generated " << (vals[0] ? "store" : "load")
+              << " at address " << std::hex << vals[1] << " with data "
+              << vals[2] << " but data " << vals[3]
+              << " was expected with byte mask " << vals[4];
+      break;
+    case kErrMemMisalignedNoSecondHalf:
+      // vals: ISS store, DUT address
+      err_str << "DUT generated first half of misaligned "
+              << (vals[0] ? "store" : "load") << " at address " << std::hex
+              << vals[1] << " but second half was expected and not seen";
+      break;
+    case kErrMemMisalignedSecondHalfAddr:
+      // vals: ISS store, DUT address, DUT second half address
+      err_str << "DUT generated first half of misaligned "
+              << (vals[0] ? "store" : "load") << " at address " << std::hex
+              << vals[1] << " but second half had incorrect address "
+              << vals[2];
+      break;
+    case kErrStepFailed:
+      // vals: instruction index, DUT PC
+      err_str << "Checking failed at instruction " << std::dec << vals[0]
+              << " (DUT PC: " << std::hex << vals[1] << ")";
+      break;
+  }
+
+  return err_str.str();
+}
+
+const std::vector<std::string> &SpikeCosim::get_errors() {
+  // Format any errors recorded since the last call
+  for (size_t i = errors.size(); i < error_records.size(); ++i) {
+    errors.emplace_back(format_error(error_records[i]));
+  }
+
+  return errors;
+}
 
-void SpikeCosim::clear_errors() { errors.clear(); }
+void SpikeCosim::clear_errors() {
+  error_records.clear();
+  errors.clear();
+}
 
 void SpikeCosim::fixup_csr(int csr_num, uint32_t csr_val) {
   switch (csr_num) {
@@ -402,20 +800,42 @@ void SpikeCosim::fixup_csr(int csr_num, uint32_t csr_val) {
   }
 }
 
+SpikeCosim::check_mem_result_e SpikeCosim::timed_check_mem_access(
+    bool store, uint32_t addr, size_t len, const uint8_t *bytes) {
+  auto start = std::chrono::steady_clock::now();
+  check_mem_result_e result = check_mem_access(store, addr, len, bytes);
+  stats.check_mem_time_ns +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count();
+
+  if (result != kCheckMemCheckFailed) {
+    stats.dside_accesses_matched++;
+  }
+
+  return result;
+}
+
+// Expand a byte enable into a mask of the bits in the enabled bytes
+static uint32_t be_to_mask(uint32_t be) {
+  static const uint32_t kBeMasks[16] = {
+      0x00000000, 0x000000ff, 0x0000ff00, 0x0000ffff,
+      0x00ff0000, 0x00ff00ff, 0x00ffff00, 0x00ffffff,
+      0xff000000, 0xff0000ff, 0xff00ff00, 0xff00ffff,
+      0xffff0000, 0xffff00ff, 0xffffff00, 0xffffffff};
+
+  return kBeMasks[be & 0xf];
+}
+
 SpikeCosim::check_mem_result_e SpikeCosim::check_mem_access(
     bool store, uint32_t addr, size_t len, const uint8_t *bytes) {
   assert(len >= 1 && len <= 4);
   // Expect that no spike memory accesses cross a 32-bit boundary
   assert(((addr + (len - 1)) & 0xfffffffc) == (addr & 0xfffffffc));
 
-  std::string iss_action = store ? "store" : "load";
-
   // Check if there are any pending DUT accesses to check against
-  if (pending_dside_accesses.size() == 0) {
-    std::stringstream err_str;
-    err_str << "A " << iss_action << " at address " << std::hex << addr
-            << " was expected but there are no pending accesses";
-    errors.emplace_back(err_str.str());
+  if (pending_dside_accesses.empty()) {
+    add_error(kErrMemNoPendingAccess, store, addr);
 
     return kCheckMemCheckFailed;
   }
@@ -423,27 +843,19 @@ SpikeCosim::check_mem_result_e SpikeCosim::check_mem_access(
   auto &top_pending_access = pending_dside_accesses.front();
   auto &top_pending_access_info = top_pending_access.dut_access_info;
 
-  std::string dut_action = top_pending_access_info.store ? "store" : "load";
-
   // Check for an address match
   uint32_t aligned_addr = addr & 0xfffffffc;
   if (aligned_addr != top_pending_access_info.addr) {
-    std::stringstream err_str;
-    err_str << "DUT generated " << dut_action << " at address " << std::hex
-            << top_pending_access_info.addr << " but " << iss_action
-            << " at address " << aligned_addr << " was expected";
-    errors.emplace_back(err_str.str());
+    add_error(kErrMemAddrMismatch, store, top_pending_access_info.store,
+              top_pending_access_info.addr, aligned_addr);
 
     return kCheckMemCheckFailed;
   }
 
   // Check access type match
   if (store != top_pending_access_info.store) {
-    std::stringstream err_str;
-    err_str << "DUT generated " << dut_action << " at addr " << std::hex
-            << top_pending_access_info.addr << " but a " << iss_action
-            << " was expected";
-    errors.emplace_back(err_str.str());
+    add_error(kErrMemTypeMismatch, store, top_pending_access_info.store,
+              top_pending_access_info.addr);
 
     return kCheckMemCheckFailed;
   }
@@ -451,6 +863,7 @@ SpikeCosim::check_mem_result_e SpikeCosim::check_mem_access(
   // Calculate bytes within aligned 32-bit word that spike has accessed
   uint32_t expected_be = ((1 << len) - 1) << (addr & 0x3);
 
+  bool pending_access_error = top_pending_access_info.error;
   bool pending_access_done = false;
   bool misaligned = top_pending_access_info.misaligned_first ||
                     top_pending_access_info.misaligned_second;
@@ -463,14 +876,9 @@ SpikeCosim::check_mem_result_e SpikeCosim::check_mem_access(
     // Check bytes accessed this time haven't already been been seen for the DUT
     // access we are trying to match against
     if ((expected_be & top_pending_access.be_spike) != 0) {
-      std::stringstream err_str;
-      err_str << "DUT generated " << dut_action << " at address " << std::hex
-              << top_pending_access_info.addr << " with BE "
-              << top_pending_access_info.be << " and expected BE "
-              << expected_be << " has been seen twice, so far seen "
-              << top_pending_access.be_spike;
-
-      errors.emplace_back(err_str.str());
+      add_error(kErrMemMisalignedBeRepeated, top_pending_access_info.store,
+                top_pending_access_info.addr, top_pending_access_info.be,
+                expected_be, top_pending_access.be_spike);
 
       return kCheckMemCheckFailed;
     }
@@ -478,32 +886,29 @@ SpikeCosim::check_mem_result_e SpikeCosim::check_mem_access(
     // Check expected access isn't trying to access bytes that the DUT access
     // didn't access.
     if ((expected_be & ~top_pending_access_info.be) != 0) {
-      std::stringstream err_str;
-      err_str << "DUT generated " << dut_action << " at address " << std::hex
-              << top_pending_access_info.addr << " with BE "
-              << top_pending_access_info.be << " but expected BE "
-              << expected_be << " has other bytes enabled";
-      errors.emplace_back(err_str.str());
+      add_error(kErrMemMisalignedBeExtra, top_pending_access_info.store,
+                top_pending_access_info.addr, top_pending_access_info.be,
+                expected_be);
       return kCheckMemCheckFailed;
     }
 
     // Record which bytes have been seen from spike
     top_pending_access.be_spike |= expected_be;
 
-    // If all bytes have been seen from spike we're done with this DUT access
-    if (top_pending_access.be_spike == top_pending_access_info.be) {
-      pending_access_done = true;
-    }
+    // If all bytes have been seen from spike we're done with this DUT access.
+    // For any misaligned access that sees an error immediately indicate to
+    // spike the error has occured, so ensure the top pending access gets
+    // removed.
+    pending_access_done =
+        (top_pending_access.be_spike == top_pending_access_info.be) ||
+        pending_access_error;
   } else {
     // For aligned accesses bytes from spike access must precisely match bytes
     // from DUT access in one go
     if (expected_be != top_pending_access_info.be) {
-      std::stringstream err_str;
-      err_str << "DUT generated " << dut_action << " at address " << std::hex
-              << top_pending_access_info.addr << " with BE "
-              << top_pending_access_info.be << " but BE " << expected_be
-              << " was expected";
-      errors.emplace_back(err_str.str());
+      add_error(kErrMemBeMismatch, top_pending_access_info.store,
+                top_pending_access_info.addr, top_pending_access_info.be,
+                expected_be);
 
       return kCheckMemCheckFailed;
     }
@@ -514,37 +919,59 @@ SpikeCosim::check_mem_result_e SpikeCosim::check_mem_access(
   // Check data from expected access matches pending DUT access.
   // Data is ignored on error responses to loads so don't check it. Always check
   // store data.
-  if (store || !top_pending_access_info.error) {
-    // Combine bytes into a single word
-    uint32_t expected_data = 0;
+  if (store || !pending_access_error) {
+    // Combine bytes into a single word and shift them into their position
+    // within an aligned 32-bit word
+    uint32_t access_data = 0;
     for (int i = 0; i < len; ++i) {
-      expected_data |= bytes[i] << (i * 8);
+      access_data |= bytes[i] << (i * 8);
     }
+    access_data <<= (addr & 0x3) * 8;
+
+    // Bytes of the word to compare and the data expected in them
+    uint32_t check_be = 0;
+    uint32_t expected_data = 0;
 
-    // Shift bytes into their position within an aligned 32-bit word
-    expected_data <<= (addr & 0x3) * 8;
+    if (!misaligned) {
+      check_be = expected_be;
+      expected_data = access_data;
+    } else if (store) {
+      // Merge the bytes of each split store and compare the whole word once
+      // spike has stored every byte of it
+      top_pending_access.data_spike |= access_data;
+      if (pending_access_done) {
+        check_be = top_pending_access.be_spike;
+        expected_data = top_pending_access.data_spike;
+      }
+    } else if (!top_pending_access.data_checked) {
+      // Spike reads a split load a byte at a time from memory that can't
+      // change in between, so compare every byte the DUT loaded against
+      // memory the first time. The remaining bytes only need their byte
+      // enables checking.
+      uint32_t mem_word;
+      if (bus.load(aligned_addr, 4, reinterpret_cast<uint8_t *>(&mem_word))) {
+        check_be = top_pending_access_info.be;
+        expected_data = mem_word & be_to_mask(check_be);
+        top_pending_access.data_checked = true;
+      } else {
+        check_be = expected_be;
+        expected_data = access_data;
+      }
+    }
 
     // Mask off bytes expected access doesn't touch and check bytes match for
     // those that it does
-    uint32_t expected_be_bits = (((uint64_t)1 << (len * 8)) - 1)
-                                << ((addr & 0x3) * 8);
-    uint32_t masked_dut_data = top_pending_access_info.data & expected_be_bits;
+    uint32_t masked_dut_data =
+        top_pending_access_info.data & be_to_mask(check_be);
 
     if (expected_data != masked_dut_data) {
-      std::stringstream err_str;
-      err_str << "DUT generated " << iss_action << " at address " << std::hex
-              << top_pending_access_info.addr << " with data "
-              << masked_dut_data << " but data " << expected_data
-              << " was expected with byte mask " << expected_be;
-
-      errors.emplace_back(err_str.str());
+      add_error(kErrMemDataMismatch, store, top_pending_access_info.addr,
+                masked_dut_data, expected_data, check_be);
 
       return kCheckMemCheckFailed;
     }
   }
 
-  bool pending_access_error = top_pending_access_info.error;
-
   if (pending_access_error && misaligned) {
     // When misaligned accesses see an error, if they have crossed a 32-bit
     // boundary DUT will generate two accesses. If the top pending access from
@@ -556,12 +983,8 @@ SpikeCosim::check_mem_result_e SpikeCosim::check_mem_access(
       // Check the second access DUT exists
       if ((pending_dside_accesses.size() < 2) ||
           !pending_dside_accesses[1].dut_access_info.misaligned_second) {
-        std::stringstream err_str;
-        err_str << "DUT generated first half of misaligned " << iss_action
-                << " at address " << std::hex << top_pending_access_info.addr
-                << " but second half was expected and not seen";
-
-        errors.emplace_back(err_str.str());
+        add_error(kErrMemMisalignedNoSecondHalf, store,
+                  top_pending_access_info.addr);
 
         return kCheckMemCheckFailed;
       }
@@ -569,13 +992,9 @@ SpikeCosim::check_mem_result_e SpikeCosim::check_mem_access(
       // Check the second access had the expected address
       if (pending_dside_accesses[1].dut_access_info.addr !=
           (top_pending_access_info.addr + 4)) {
-        std::stringstream err_str;
-        err_str << "DUT generated first half of misaligned " << iss_action
-                << " at address " << std::hex << top_pending_access_info.addr
-                << " but second half had incorrect address "
-                << pending_dside_accesses[1].dut_access_info.addr;
-
-        errors.emplace_back(err_str.str());
+        add_error(kErrMemMisalignedSecondHalfAddr, store,
+                  top_pending_access_info.addr,
+                  pending_dside_accesses[1].dut_access_info.addr);
 
         return kCheckMemCheckFailed;
       }
@@ -584,30 +1003,289 @@ SpikeCosim::check_mem_result_e SpikeCosim::check_mem_access(
 
       // Remove the top pending access now so both the first and second DUT
       // accesses for this misaligned access are removed.
-      pending_dside_accesses.erase(pending_dside_accesses.begin());
+      pending_dside_accesses.pop_front();
     }
-
-    // For any misaligned access that sees an error immediately indicate to
-    // spike the error has occured, so ensure the top pending access gets
-    // removed.
-    pending_access_done = true;
   }
 
   if (pending_access_done) {
-    pending_dside_accesses.erase(pending_dside_accesses.begin());
+    pending_dside_accesses.pop_front();
   }
 
   return pending_access_error ? kCheckMemBusError : kCheckMemOk;
 }
 
-bool SpikeCosim::pc_is_mret(uint32_t pc) {
-  uint32_t insn;
+bool SpikeCosim::read_insn(uint32_t pc, uint32_t &insn) {
+  uint16_t insn_lo;
+
+  if (!backdoor_read_mem(pc, 2, reinterpret_cast<uint8_t *>(&insn_lo))) {
+    return false;
+  }
+
+  if ((insn_lo & 0x3) != 0x3) {
+    insn = insn_lo;
+    return true;
+  }
+
+  return backdoor_read_mem(pc, 4, reinterpret_cast<uint8_t *>(&insn));
+}
+
+void SpikeCosim::fast_forward(uint64_t num_insns) {
+  fast_forwarding = true;
+  // Drop translations cached with checking enabled
+  processor->get_mmu()->flush_tlb();
+
+  processor->step(num_insns);
+
+  // Translations cached whilst fast forwarding would bypass checking
+  processor->get_mmu()->flush_tlb();
+  fast_forwarding = false;
+}
+
+uint32_t SpikeCosim::get_pc() { return processor->get_state()->pc; }
+
+uint32_t SpikeCosim::get_gpr(int reg) {
+  assert(reg < NXPR);
+
+  return processor->get_state()->XPR[reg];
+}
+
+reg_t SpikeCosim::get_priv() { return processor->get_state()->prv; }
+
+bool SpikeCosim::get_debug_mode() { return processor->get_state()->debug_mode; }
 
-  if (!backdoor_read_mem(pc, 4, reinterpret_cast<uint8_t *>(&insn))) {
+uint64_t SpikeCosim::get_minstret() {
+  return processor->get_state()->minstret->read();
+}
+
+bool SpikeCosim::get_csr(int csr_num, uint32_t &csr_val) {
+  auto &csrmap = processor->get_state()->csrmap;
+  auto csr = csrmap.find(csr_num);
+  if (csr == csrmap.end()) {
     return false;
   }
 
-  return insn == 0x30200073;
+  csr_val = csr->second->read();
+  return true;
+}
+
+void SpikeCosim::set_csr(int csr_num, uint32_t csr_val) {
+#ifdef OLD_SPIKE
+  processor->set_csr(csr_num, csr_val);
+#else
+  processor->put_csr(csr_num, csr_val);
+#endif
 }
 
 int SpikeCosim::get_insn_cnt() { return insn_cnt; }
+
+CosimStats SpikeCosim::get_stats() {
+  CosimStats cur_stats = stats;
+  cur_stats.dpi_calls = num_dpi_calls;
+
+  return cur_stats;
+}
+
+static bool is_pmpcfg(reg_t csr_num) {
+  return (csr_num >= CSR_PMPCFG0) && (csr_num < CSR_PMPCFG0 + 16);
+}
+
+std::shared_ptr<CosimState> SpikeCosim::save_state() {
+  auto saved = std::make_shared<SavedState>();
+  state_t *proc_state = processor->get_state();
+
+  saved->owner = this;
+
+  saved->pc = proc_state->pc;
+  saved->prv = proc_state->prv;
+  saved->debug_mode = proc_state->debug_mode;
+  saved->nmi = proc_state->nmi;
+  saved->halt_request = processor->halt_request;
+  for (int i = 0; i < NXPR; ++i) {
+    saved->gprs[i] = proc_state->XPR[i];
+  }
+
+  std::vector<std::pair<reg_t, reg_t>> pmpcfgs;
+  for (auto &csr : proc_state->csrmap) {
+    switch (csr.first) {
+      // Counters are written as 64-bit values below, the other counter CSRs
+      // are views of these.
+      case CSR_MCYCLE:
+      case CSR_MCYCLEH:
+      case CSR_MINSTRET:
+      case CSR_MINSTRETH:
+      case CSR_CYCLE:
+      case CSR_CYCLEH:
+      case CSR_INSTRET:
+      case CSR_INSTRETH:
+      // Trigger data is per trigger and is saved below.
+      case CSR_TDATA1:
+      case CSR_TDATA2:
+      case CSR_TDATA3:
+      case CSR_MSECCFG:
+        break;
+      default:
+        if (is_pmpcfg(csr.first)) {
+          pmpcfgs.emplace_back(csr.first, csr.second->read());
+        } else {
+          saved->csrs.emplace_back(csr.first, csr.second->read());
+        }
+    }
+  }
+
+  // Writing PMP configuration may lock other PMP CSRs so it must be restored
+  // last
+  saved->csrs.insert(saved->csrs.end(), pmpcfgs.begin(), pmpcfgs.end());
+
+  saved->mcycle = proc_state->mcycle->read();
+  saved->minstret = proc_state->minstret->read();
+
+  saved->has_mseccfg = proc_state->csrmap.count(CSR_MSECCFG) != 0;
+  if (saved->has_mseccfg) {
+    saved->mseccfg = proc_state->csrmap[CSR_MSECCFG]->read();
+  }
+
+  // Step through the triggers with tselect to read the data of each one.
+  // Writes of tselect beyond the last trigger are ignored.
+  if (proc_state->csrmap.count(CSR_TSELECT)) {
+    auto &tselect = proc_state->csrmap[CSR_TSELECT];
+    reg_t orig_tselect = tselect->read();
+
+    for (reg_t i = 0;; ++i) {
+      tselect->write(i);
+      if (tselect->read() != i) {
+        break;
+      }
+
+      saved->triggers.emplace_back(proc_state->csrmap[CSR_TDATA1]->read(),
+                                   proc_state->csrmap[CSR_TDATA2]->read());
+    }
+
+    tselect->write(orig_tselect);
+  }
+
+  saved->nmi_mode = nmi_mode;
+  saved->mstack = mstack;
+  for (size_t i = 0; i < pending_dside_accesses.size(); ++i) {
+    saved->pending_dside_accesses.push_back(pending_dside_accesses[i]);
+  }
+  saved->pending_iside_error = pending_iside_error;
+  saved->pending_iside_err_addr = pending_iside_err_addr;
+  saved->insn_cnt = insn_cnt;
+
+  live_states.emplace_back(saved);
+
+  return saved;
+}
+
+bool SpikeCosim::restore_state(const std::shared_ptr<CosimState> &state) {
+  auto saved = std::dynamic_pointer_cast<SavedState>(state);
+  if (!saved || saved->owner != this) {
+    return false;
+  }
+
+  // Return every page written since the state was saved to its saved contents
+  for (auto &page : saved->mem_pages) {
+    save_mem_pages(page.first, PGSIZE);
+    bus.store(page.first, PGSIZE, page.second.data());
+  }
+
+  // Reset the processor so no CSRs are locked (e.g. by PMP configuration)
+  // before writing back the saved values.
+  processor->reset();
+  processor->set_mmu_capability(IMPL_MMU_SBARE);
+
+  state_t *proc_state = processor->get_state();
+
+  // Triggers with dmode set can only be written from debug mode
+  proc_state->debug_mode = true;
+
+  for (size_t i = 0; i < saved->triggers.size(); ++i) {
+    proc_state->csrmap[CSR_TSELECT]->write(i);
+    proc_state->csrmap[CSR_TDATA1]->write(saved->triggers[i].first);
+    proc_state->csrmap[CSR_TDATA2]->write(saved->triggers[i].second);
+  }
+
+  // Set rule locking bypass so PMP configuration can be written regardless of
+  // the saved mseccfg. The saved value is written after PMP configuration.
+  if (saved->has_mseccfg) {
+    proc_state->csrmap[CSR_MSECCFG]->write(saved->mseccfg | MSECCFG_RLB);
+  }
+
+  for (auto &csr : saved->csrs) {
+    if (csr.first == CSR_MIP) {
+      // Only some bits of mip are writable by a normal CSR write
+      proc_state->mip->write_with_mask(0xffffffff, csr.second);
+    } else {
+      proc_state->csrmap[csr.first]->write(csr.second);
+    }
+  }
+
+  if (saved->has_mseccfg) {
+    proc_state->csrmap[CSR_MSECCFG]->write(saved->mseccfg);
+  }
+
+  // Spike decrements counters on write, see `set_mcycle`
+  proc_state->mcycle->write(saved->mcycle + 1);
+  proc_state->minstret->write(saved->minstret + 1);
+
+  for (int i = 1; i < NXPR; ++i) {
+    proc_state->XPR.write(i, saved->gprs[i]);
+  }
+
+  proc_state->pc = saved->pc;
+  proc_state->prv = saved->prv;
+  proc_state->debug_mode = saved->debug_mode;
+  proc_state->nmi = saved->nmi;
+  processor->halt_request = saved->halt_request;
+
+  // Memory and privilege may have changed under any cached translations or
+  // decoded instructions
+  processor->get_mmu()->flush_tlb();
+  processor->get_mmu()->flush_icache();
+
+  nmi_mode = saved->nmi_mode;
+  mstack = saved->mstack;
+  pending_dside_accesses.clear();
+  for (auto &access : saved->pending_dside_accesses) {
+    pending_dside_accesses.push_back(access);
+  }
+  pending_iside_error = saved->pending_iside_error;
+  pending_iside_err_addr = saved->pending_iside_err_addr;
+  insn_cnt = saved->insn_cnt;
+
+  return true;
+}
+
+void SpikeCosim::save_mem_pages(reg_t addr, size_t len) {
+  if (live_states.empty() || len == 0) {
+    return;
+  }
+
+  // Forget states that can no longer be restored
+  live_states.erase(
+      std::remove_if(live_states.begin(), live_states.end(),
+                     [](const std::weak_ptr<SavedState> &state) {
+                       return state.expired();
+                     }),
+      live_states.end());
+
+  reg_t first_page = addr & ~(reg_t)(PGSIZE - 1);
+  reg_t last_page = (addr + len - 1) & ~(reg_t)(PGSIZE - 1);
+
+  for (auto &live_state : live_states) {
+    auto state = live_state.lock();
+
+    for (reg_t page = first_page; page <= last_page; page += PGSIZE) {
+      if (state->mem_pages.count(page)) {
+        continue;
+      }
+
+      // Pages not wholly backed by memory (e.g. at the edge of a memory) can't
+      // be saved, writes to them aren't undone by `restore_state`.
+      std::vector<uint8_t> contents(PGSIZE);
+      if (bus.load(page, PGSIZE, contents.data())) {
+        state->mem_pages.emplace(page, std::move(contents));
+      }
+    }
+  }
+}
@@ -6,6 +6,8 @@
 #define SPIKE_COSIM_H_
 
 #include "cosim.h"
+#include "ring_buffer.h"
+#include "sparse_mem.h"
 #include "riscv/devices.h"
 #include "riscv/log_file.h"
 #include "riscv/processor.h"
@@ -15,6 +17,7 @@
 #include <deque>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 class SpikeCosim : public simif_t, public Cosim {
@@ -23,10 +26,48 @@ class SpikeCosim : public simif_t, public Cosim {
   std::unique_ptr<processor_t> processor;
   std::unique_ptr<log_file_t> log;
   bus_t bus;
-  std::vector<std::unique_ptr<mem_t>> mems;
-  std::vector<std::string> errors;
+  std::vector<std::unique_ptr<abstract_device_t>> mems;
   bool nmi_mode;
 
+  typedef enum {
+    kErrSyncTrapNotSeen,
+    kErrSyncTrapPcMismatch,
+    kErrSyncTrapRegWrite,
+    kErrPcMismatch,
+    kErrUnexpectedRegWrite,
+    kErrIsideErrorNotSeen,
+    kErrRegWriteNotSeen,
+    kErrRegWriteIdxMismatch,
+    kErrRegWriteDataMismatch,
+    kErrMemNoPendingAccess,
+    kErrMemAddrMismatch,
+    kErrMemTypeMismatch,
+    kErrMemMisalignedBeRepeated,
+    kErrMemMisalignedBeExtra,
+    kErrMemBeMismatch,
+    kErrMemDataMismatch,
+    kErrMemMisalignedNoSecondHalf,
+    kErrMemMisalignedSecondHalfAddr,
+    kErrStepFailed
+  } cosim_error_e;
+
+  // An error seen during checking. Only the numeric details are recorded so
+  // no allocation is needed; the message is produced by `format_error` when
+  // `get_errors` is called. See `format_error` for the meaning of `vals` for
+  // each error code.
+  struct ErrorRecord {
+    cosim_error_e code;
+    uint64_t vals[5];
+  };
+
+  std::vector<ErrorRecord> error_records;
+  // Messages for `error_records`, built by `get_errors`
+  std::vector<std::string> errors;
+
+  void add_error(cosim_error_e code, uint64_t val0 = 0, uint64_t val1 = 0,
+                 uint64_t val2 = 0, uint64_t val3 = 0, uint64_t val4 = 0);
+  std::string format_error(const ErrorRecord &error) const;
+
   typedef struct {
     uint8_t mpp;
     bool mpie;
@@ -40,14 +81,65 @@ class SpikeCosim : public simif_t, public Cosim {
 
   struct PendingMemAccess {
     DSideAccessInfo dut_access_info;
+    // For misaligned accesses, which spike splits into byte accesses, the
+    // bytes seen from spike so far. Stored bytes are merged into `data_spike`
+    // and checked once the word is complete, loaded bytes are all checked on
+    // the first access (setting `data_checked`).
     uint32_t be_spike;
+    uint32_t data_spike;
+    bool data_checked;
   };
 
-  std::vector<PendingMemAccess> pending_dside_accesses;
+  RingBuffer<PendingMemAccess> pending_dside_accesses;
 
   bool pending_iside_error;
   uint32_t pending_iside_err_addr;
 
+  bool direct_fetch;
+
+  // Set whilst in `fast_forward`, memory accesses aren't checked
+  bool fast_forwarding;
+
+  // State captured by `save_state`
+  struct SavedState : public CosimState {
+    const SpikeCosim *owner;
+
+    reg_t pc;
+    reg_t prv;
+    bool debug_mode;
+    bool nmi;
+    decltype(processor_t::halt_request) halt_request;
+    reg_t gprs[NXPR];
+    // CSR number and value pairs, PMP configuration CSRs are last. Doesn't
+    // include counters, trigger data or mseccfg which are held separately.
+    std::vector<std::pair<reg_t, reg_t>> csrs;
+    uint64_t mcycle;
+    uint64_t minstret;
+    // tdata1 and tdata2 for each trigger
+    std::vector<std::pair<reg_t, reg_t>> triggers;
+    bool has_mseccfg;
+    reg_t mseccfg;
+
+    bool nmi_mode;
+    mstack_t mstack;
+    std::vector<PendingMemAccess> pending_dside_accesses;
+    bool pending_iside_error;
+    uint32_t pending_iside_err_addr;
+    int insn_cnt;
+
+    // Saved contents of memory pages, keyed by page address. A page is only
+    // copied here before it is first written after the state was saved, so any
+    // page not present is unchanged since then.
+    std::unordered_map<reg_t, std::vector<uint8_t>> mem_pages;
+  };
+
+  // Saved states that may still be restored
+  std::vector<std::weak_ptr<SavedState>> live_states;
+
+  // Copy any pages in [addr, addr + len) not yet saved into each live state.
+  // Must be called before any write to memory.
+  void save_mem_pages(reg_t addr, size_t len);
+
   typedef enum {
     kCheckMemOk,           // Checks passed and access succeded in RTL
     kCheckMemCheckFailed,  // Checks failed
@@ -56,23 +148,81 @@ class SpikeCosim : public simif_t, public Cosim {
 
   check_mem_result_e check_mem_access(bool store, uint32_t addr, size_t len,
                                       const uint8_t *bytes);
+  // Call `check_mem_access` and record its time and result in `stats`
+  check_mem_result_e timed_check_mem_access(bool store, uint32_t addr,
+                                            size_t len, const uint8_t *bytes);
+
+  // Step the processor by one instruction, recording the time taken in `stats`
+  void timed_proc_step();
+
+  // Implements `step`, which records which instruction failed
+  bool check_step(uint32_t write_reg, uint32_t write_reg_data, uint32_t pc,
+                  bool sync_trap);
+
+  // A register write made by the most recently stepped instruction
+  struct RegWrite {
+    bool csr;
+    uint32_t index;
+    uint32_t data;
+  };
 
-  bool pc_is_mret(uint32_t pc);
+  // Register writes made by the most recently stepped instruction. These are
+  // captured directly from the ISS state rather than from spike's commit log
+  // so commit logging (and its per-instruction formatting cost) is only
+  // needed when a trace log is wanted. An instruction writes at most one GPR
+  // and one CSR.
+  static const int kMaxRegWrites = 2;
+  RegWrite reg_writes[kMaxRegWrites];
+  int num_reg_writes;
 
-  bool check_gpr_write(const commit_log_reg_t::value_type &reg_change,
+  // Fill `reg_writes` for `insn`, the instruction just stepped
+  void capture_reg_writes(uint32_t insn);
+
+  // Read the (possibly compressed) instruction at `pc` into `insn`
+  bool read_insn(uint32_t pc, uint32_t &insn);
+
+  bool check_gpr_write(uint32_t cosim_write_reg, uint32_t cosim_write_reg_data,
                        uint32_t write_reg, uint32_t write_reg_data);
 
-  void on_csr_write(const commit_log_reg_t::value_type &reg_change);
+  void on_csr_write(int cosim_write_csr, uint32_t cosim_write_csr_data);
 
   void leave_nmi_mode();
 
   int insn_cnt;
 
+  CosimStats stats;
+
  public:
   SpikeCosim(const std::string &isa_string, uint32_t start_pc,
              uint32_t start_mtvec, const std::string &trace_log_path,
              bool secure_ibex, bool icache_en);
 
+  // Serve instruction fetches from memories added with `add_memory` directly
+  // via `addr_to_mem`, so spike's TLB and decode caches can be used for them.
+  // Data accesses still go via `mmio_load`/`mmio_store` and are checked
+  // against DUT accesses. Disabled by default.
+  void set_direct_fetch(bool en);
+
+  // Run `num_insns` instructions without checking them against the DUT, to
+  // skip over code that doesn't need verifying (e.g. the boot of a long
+  // benchmark). Memory is accessed directly via `addr_to_mem` so spike runs at
+  // full speed. Data accesses outside of co-simulator memory (e.g. to devices)
+  // read as zero and stores to them are dropped. No interrupts are taken.
+  //
+  // Once done the architectural state can be read with the accessors below
+  // and transferred to the DUT, which is then checked from that point on.
+  void fast_forward(uint64_t num_insns);
+
+  // Architectural state accessors, for transferring state to the DUT
+  uint32_t get_pc();
+  uint32_t get_gpr(int reg);
+  reg_t get_priv();
+  bool get_debug_mode();
+  uint64_t get_minstret();
+  // Returns false if spike doesn't implement `csr_num`
+  bool get_csr(int csr_num, uint32_t &csr_val);
+  void set_csr(int csr_num, uint32_t csr_val);
+
   // simif_t implementation
   virtual char *addr_to_mem(reg_t addr) override;
   virtual bool mmio_load(reg_t addr, size_t len, uint8_t *bytes) override;
@@ -102,6 +252,9 @@ class SpikeCosim : public simif_t, public Cosim {
   const std::vector<std::string> &get_errors() override;
   void clear_errors() override;
   int get_insn_cnt() override;
+  CosimStats get_stats() override;
+  std::shared_ptr<CosimState> save_state() override;
+  bool restore_state(const std::shared_ptr<CosimState> &state) override;
 };
 
 #endif  // SPIKE_COSIM_H_
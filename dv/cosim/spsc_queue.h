@@ -0,0 +1,56 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Fixed capacity lock-free queue for passing items from a single producer
+// thread to a single consumer thread. `Capacity` must be a power of two.
+template <typename T, size_t Capacity>
+class SpscQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "SpscQueue capacity must be a power of two");
+
+ public:
+  SpscQueue() : head(0), tail(0) {}
+
+  // Called by the producer. Returns false if the queue is full.
+  bool try_push(const T &item) {
+    size_t cur_tail = tail.load(std::memory_order_relaxed);
+    if (cur_tail - head.load(std::memory_order_acquire) == Capacity) {
+      return false;
+    }
+
+    items[cur_tail & (Capacity - 1)] = item;
+    tail.store(cur_tail + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  // Called by the consumer. Returns false if the queue is empty.
+  bool try_pop(T &item) {
+    size_t cur_head = head.load(std::memory_order_relaxed);
+    if (cur_head == tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    item = items[cur_head & (Capacity - 1)];
+    head.store(cur_head + 1, std::memory_order_release);
+
+    return true;
+  }
+
+ private:
+  // `head` and `tail` count items popped and pushed respectively. They are
+  // kept on separate cache lines so producer and consumer don't contend.
+  alignas(64) std::atomic<size_t> head;
+  alignas(64) std::atomic<size_t> tail;
+  std::array<T, Capacity> items;
+};
+
+#endif  // SPSC_QUEUE_H_
@@ -44,4 +44,9 @@ class ibex_cosim_agent extends uvm_agent;
   function void write_mem_byte(bit [31:0] addr, bit [7:0] d);
     riscv_cosim_write_mem_byte(scoreboard.cosim_handle, addr, d);
   endfunction
+
+  // Write a block of bytes starting at `addr` with a single DPI call
+  function void write_mem_block(bit [31:0] addr, bit [7:0] data[]);
+    riscv_cosim_write_mem_block(scoreboard.cosim_handle, addr, data);
+  endfunction
 endclass : ibex_cosim_agent
@@ -5,3 +5,4 @@
 ${PRJ_DIR}/dv/uvm/core_ibex/common/ibex_cosim_agent/spike_cosim_dpi.cc
 ${PRJ_DIR}/dv/cosim/cosim_dpi.cc
 ${PRJ_DIR}/dv/cosim/spike_cosim.cc
+${PRJ_DIR}/dv/cosim/sparse_mem.cc
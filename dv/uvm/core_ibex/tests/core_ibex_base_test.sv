@@ -163,6 +163,7 @@ class core_ibex_base_test extends uvm_test;
     bit [7:0]   r8;
     bit [31:0]  addr = 32'h`BOOT_ADDR;
     int         f_bin;
+    bit [7:0]   bin_data[$];
     void'($value$plusargs("bin=%0s", bin));
     if (bin == "")
       `uvm_fatal(get_full_name(), "Please specify test binary by +bin=binary_name")
@@ -173,13 +174,15 @@ class core_ibex_base_test extends uvm_test;
     while ($fread(r8,f_bin)) begin
       `uvm_info(`gfn, $sformatf("Init mem [0x%h] = 0x%0h", addr, r8), UVM_FULL)
       mem.write(addr, r8);
-`ifdef INC_IBEX_COSIM
-      if (env.cosim_agent != null) begin
-        env.cosim_agent.write_mem_byte(addr, r8);
-      end
-`endif
+      bin_data.push_back(r8);
       addr++;
     end
+`ifdef INC_IBEX_COSIM
+    // Copy the whole binary to the co-simulator in one go
+    if (env.cosim_agent != null) begin
+      env.cosim_agent.write_mem_block(32'h`BOOT_ADDR, bin_data);
+    end
+`endif
   endfunction
 
   virtual task wait_for_test_done();
@@ -18,6 +18,7 @@ module ibex_simple_system_cosim_checker (
   input logic        host_dmem_err
 );
   import "DPI-C" function chandle get_spike_cosim;
+  import "DPI-C" function int get_cosim_unbatched_insns;
 
   chandle cosim_handle;
 
@@ -25,25 +26,80 @@ module ibex_simple_system_cosim_checker (
     cosim_handle = get_spike_cosim();
   end
 
+  // Retired instructions are checked in batches to amortise the cost of crossing the DPI boundary.
+  // Dside accesses are still notified as they are seen; the co-simulator queues them until the
+  // instruction that performs them is stepped. A mismatch is only seen when its batch is checked,
+  // up to a batch later than the failing instruction retired. The errors identify the failing
+  // instruction. Pass +cosim_batch_size=1 to check every instruction as it retires.
+  localparam int unsigned CosimMaxBatchSize = 64;
+
+  bit [191:0]  retire_batch [CosimMaxBatchSize];
+  int unsigned retire_batch_count = 0;
+  int unsigned cosim_batch_size = CosimMaxBatchSize;
+
+  // The first instructions retired may need checking one at a time, e.g. the restore stub run
+  // after fast forwarding, whose RAM is put back as soon as its last instruction is checked.
+  int unsigned unbatched_insns_left;
+
+  initial begin
+    unbatched_insns_left = get_cosim_unbatched_insns();
+
+    if ($value$plusargs("cosim_batch_size=%d", cosim_batch_size)) begin
+      if (cosim_batch_size == 0 || cosim_batch_size > CosimMaxBatchSize) begin
+        $fatal(1, "cosim_batch_size must be between 1 and %0d", CosimMaxBatchSize);
+      end
+    end
+  end
+
+  function automatic void flush_retire_batch();
+    int num_checked;
+
+    if (retire_batch_count == 0) begin
+      return;
+    end
+
+    num_checked = riscv_cosim_step_batch(cosim_handle, retire_batch, retire_batch_count);
+
+    if (num_checked != retire_batch_count) begin
+      $display("FAILURE: Co-simulation mismatch at time %t", $time());
+      for (int i = 0;i < riscv_cosim_get_num_errors(cosim_handle); ++i) begin
+        $display(riscv_cosim_get_error(cosim_handle, i));
+      end
+      riscv_cosim_clear_errors(cosim_handle);
+
+      $fatal(1, "Co-simulation mismatch seen");
+    end
+
+    retire_batch_count = 0;
+  endfunction
+
   always @(posedge clk_i) begin
     if (u_top.rvfi_valid & !u_top.rvfi_trap) begin
-      riscv_cosim_set_nmi(cosim_handle, u_top.rvfi_ext_nmi);
-      riscv_cosim_set_mip(cosim_handle, u_top.rvfi_ext_mip);
-      riscv_cosim_set_debug_req(cosim_handle, u_top.rvfi_ext_debug_req);
-      riscv_cosim_set_mcycle(cosim_handle, u_top.rvfi_ext_mcycle);
-
-      if (riscv_cosim_step(cosim_handle, u_top.rvfi_rd_addr, u_top.rvfi_rd_wdata,
-                           u_top.rvfi_pc_rdata, u_top.rvfi_trap) == 0)
-      begin
-        $display("FAILURE: Co-simulation mismatch at time %t", $time());
-        for (int i = 0;i < riscv_cosim_get_num_errors(cosim_handle); ++i) begin
-          $display(riscv_cosim_get_error(cosim_handle, i));
-        end
-        riscv_cosim_clear_errors(cosim_handle);
-
-        $fatal(1, "Co-simulation mismatch seen");
+      retire_batch[retire_batch_count] = {24'b0, u_top.rvfi_ext_debug_req, u_top.rvfi_ext_nmi,
+        u_top.rvfi_trap, u_top.rvfi_rd_addr, u_top.rvfi_ext_mcycle, u_top.rvfi_ext_mip,
+        u_top.rvfi_rd_wdata, u_top.rvfi_pc_rdata};
+      retire_batch_count++;
+
+      if (unbatched_insns_left != 0) begin
+        unbatched_insns_left--;
+        flush_retire_batch();
       end
     end
+
+    // Once software has asked simulator_ctrl to end the simulation check everything retired
+    // before it calls $finish, so a mismatch still fails the simulation.
+    if (retire_batch_count == cosim_batch_size || u_simulator_ctrl.sim_finish != '0) begin
+      flush_retire_batch();
+    end
+  end
+
+  // The simulation may end other than through simulator_ctrl (e.g. on a cycle limit). Check
+  // anything retired since the last batch, it's too late to stop the simulation so errors are
+  // left for the simulator to report once it has finished.
+  final begin
+    if (retire_batch_count != 0) begin
+      void'(riscv_cosim_step_batch(cosim_handle, retire_batch, retire_batch_count));
+    end
   end
 
   logic outstanding_store;
@@ -2,26 +2,375 @@
 // Licensed under the Apache License, Version 2.0, see LICENSE for details.
 // SPDX-License-Identifier: Apache-2.0
 
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <memory>
+#include "async_cosim.h"
 #include "cosim.h"
+#include "cosim_trace.h"
+#include "cosim_wrapper.h"
 #include "ibex_simple_system.h"
 #include "spike_cosim.h"
 #include "verilator_memutil.h"
 
+// Instruction encodings used to build the restore stub, see
+// `SimpleSystemCosim::FastForward`
+static uint32_t EncodeLui(uint32_t rd, uint32_t imm) {
+  return (imm & 0xfffff000) | (rd << 7) | 0x37;
+}
+
+static uint32_t EncodeAddi(uint32_t rd, uint32_t rs1, uint32_t imm) {
+  return ((imm & 0xfff) << 20) | (rs1 << 15) | (rd << 7) | 0x13;
+}
+
+static uint32_t EncodeCsrw(uint32_t csr, uint32_t rs1) {
+  return (csr << 20) | (rs1 << 15) | (0x1 << 12) | 0x73;
+}
+
+static uint32_t EncodeJal(uint32_t rd, int32_t offset) {
+  uint32_t imm = offset;
+  return (((imm >> 20) & 0x1) << 31) | (((imm >> 1) & 0x3ff) << 21) |
+         (((imm >> 11) & 0x1) << 20) | (((imm >> 12) & 0xff) << 12) |
+         (rd << 7) | 0x6f;
+}
+
+static const uint32_t kMretInsn = 0x30200073;
+
+// Append a lui/addi pair loading `val` into `rd`. Always two instructions so
+// the stub length doesn't depend on the values loaded.
+static void EmitLoadImm(std::vector<uint32_t> &insns, uint32_t rd,
+                        uint32_t val) {
+  uint32_t hi = (val + 0x800) & 0xfffff000;
+  insns.push_back(EncodeLui(rd, hi));
+  insns.push_back(EncodeAddi(rd, rd, val - hi));
+}
+
+// Wraps the co-simulator after a fast forward. The DUT first runs a restore
+// stub that loads the co-simulator's architectural state; the stub's
+// instructions aren't checked and once they have all retired `on_stub_done` is
+// called. Must be the outermost wrapper so `on_stub_done` runs on the
+// simulation thread.
+//
+// Other calls are forwarded as they are. Interrupts are disabled whilst the
+// stub runs, so anything set before it completes is set again with the first
+// checked instruction.
+class FastForwardCosim : public CosimWrapper {
+ public:
+  FastForwardCosim(Cosim *cosim, int num_stub_insns,
+                   std::function<void()> on_stub_done)
+      : CosimWrapper(cosim),
+        stub_insns_left(num_stub_insns),
+        on_stub_done(on_stub_done) {}
+
+  bool step(uint32_t write_reg, uint32_t write_reg_data, uint32_t pc,
+            bool sync_trap) override {
+    if (stub_insns_left) {
+      retire_stub_insns(1);
+      return true;
+    }
+
+    return cosim->step(write_reg, write_reg_data, pc, sync_trap);
+  }
+
+  int step_batch(const RetireInfo *retire_info, int num_insns) override {
+    int num_skipped = std::min(num_insns, stub_insns_left);
+    retire_stub_insns(num_skipped);
+
+    return num_skipped + cosim->step_batch(retire_info + num_skipped,
+                                           num_insns - num_skipped);
+  }
+
+  int get_stub_insns_left() const { return stub_insns_left; }
+
+ private:
+  int stub_insns_left;
+  std::function<void()> on_stub_done;
+
+  void retire_stub_insns(int num_insns) {
+    if (num_insns == 0) {
+      return;
+    }
+
+    stub_insns_left -= num_insns;
+    if (stub_insns_left == 0) {
+      on_stub_done();
+    }
+  }
+};
+
 class SimpleSystemCosim : public SimpleSystem {
  public:
   std::unique_ptr<SpikeCosim> _cosim;
+  // When running with --cosim-trace all co-simulator calls go via this wrapper,
+  // which records them so they can be replayed without the RTL.
+  std::unique_ptr<CosimTraceRecorder> _trace_cosim;
+  // When running with --cosim-async all co-simulator calls go via this wrapper,
+  // which checks instructions on a separate thread.
+  std::unique_ptr<AsyncCosim> _async_cosim;
+  // When running with --cosim-fast-forward all co-simulator calls go via this
+  // wrapper, which skips the instructions of the restore stub.
+  std::unique_ptr<FastForwardCosim> _ff_cosim;
 
   SimpleSystemCosim(const char *ram_hier_path, int ram_size_words)
-      : SimpleSystem(ram_hier_path, ram_size_words), _cosim(nullptr) {}
+      : SimpleSystem(ram_hier_path, ram_size_words),
+        _cosim(nullptr),
+        _trace_cosim(nullptr),
+        _async_cosim(nullptr),
+        _ff_cosim(nullptr) {}
 
   ~SimpleSystemCosim() {}
 
+  // Number of instructions the checker must step one at a time from the start
+  // of simulation. When fast forwarding the RAM under the restore stub is put
+  // back as soon as its last instruction is stepped, so the stub can't be
+  // checked as part of a batch that continues past it.
+  int GetUnbatchedInsns() {
+    return _ff_cosim ? _ff_cosim->get_stub_insns_left() : 0;
+  }
+
+  Cosim *GetCosim() {
+    if (_ff_cosim) {
+      return _ff_cosim.get();
+    }
+
+    if (_async_cosim) {
+      return _async_cosim.get();
+    }
+
+    if (_trace_cosim) {
+      return _trace_cosim.get();
+    }
+
+    return _cosim.get();
+  }
+
  protected:
-  void CopyMemAreaToCosim(MemArea *area, uint32_t base_addr) {
+  void CopyMemAreaToCosim(MemArea *area, const std::string &mem_name,
+                          uint32_t base_addr) {
+    // When the memory was loaded from an ELF file its segments are still
+    // staged, copy those straight into the co-simulator. This avoids reading
+    // the memory back a word at a time over DPI. The rest of the memory is
+    // zero, which matches the co-simulator memory.
+    const StagedMem &staged_mem =
+        _memutil.GetUnderlying()->GetMemoryData(mem_name);
+    if (staged_mem.GetSegs().size()) {
+      for (const auto &seg : staged_mem.GetSegs()) {
+        GetCosim()->backdoor_write_mem(base_addr + seg.first.lo,
+                                       seg.second.size(), &seg.second[0]);
+      }
+
+      return;
+    }
+
     auto mem_data = area->Read(0, area->GetSizeWords());
-    _cosim->backdoor_write_mem(base_addr, area->GetSizeBytes(), &mem_data[0]);
+    GetCosim()->backdoor_write_mem(base_addr, area->GetSizeBytes(),
+                                   &mem_data[0]);
+  }
+
+  // Base address and size of the RAM, both in the DUT and the co-simulator
+  static const uint32_t kRamBase = 0x100000;
+  static const uint32_t kRamSize = 1024 * 1024;
+  // Where the DUT starts executing from reset
+  static const uint32_t kResetPc = kRamBase + 0x80;
+
+  // Original RAM contents overwritten by the restore stub
+  uint32_t _ff_stub_addr;
+  std::vector<uint8_t> _ff_saved_reset_insn;
+  std::vector<uint8_t> _ff_saved_stub_mem;
+
+  // Machine CSRs the restore stub writes when the co-simulator's value differs
+  // from its reset value. mstatus, mepc and minstret are written separately.
+  static std::vector<int> FastForwardCsrs() {
+    std::vector<int> csrs = {CSR_MIE,       CSR_MTVEC, CSR_MSCRATCH,
+                             CSR_MCAUSE,    CSR_MTVAL, CSR_MCOUNTEREN,
+                             CSR_MCOUNTINHIBIT};
+    for (int i = 0; i < 29; ++i) {
+      csrs.push_back(CSR_MHPMEVENT3 + i);
+    }
+    for (int i = 0; i < 29; ++i) {
+      csrs.push_back(CSR_MHPMCOUNTER3 + i);
+      csrs.push_back(CSR_MHPMCOUNTER3H + i);
+    }
+
+    return csrs;
+  }
+
+  // Read the co-simulator CSRs that can't be transferred to the DUT: PMP,
+  // mseccfg and the triggers. The restore stub runs in M mode from RAM and
+  // writing these could stop it from running, so fast forwarding is refused
+  // unless they are left at their reset values.
+  std::vector<std::pair<int, uint32_t>> ReadUntransferableCsrs() {
+    std::vector<std::pair<int, uint32_t>> csrs;
+    auto read_csr = [&](int csr_num) {
+      uint32_t val;
+      if (_cosim->get_csr(csr_num, val)) {
+        csrs.emplace_back(csr_num, val);
+      }
+    };
+
+    for (int i = 0; i < 4; ++i) {
+      read_csr(CSR_PMPCFG0 + i);
+    }
+    for (int i = 0; i < 16; ++i) {
+      read_csr(CSR_PMPADDR0 + i);
+    }
+    read_csr(CSR_MSECCFG);
+
+    // Step through the triggers with tselect, writes beyond the last trigger
+    // are ignored
+    uint32_t orig_tselect;
+    if (_cosim->get_csr(CSR_TSELECT, orig_tselect)) {
+      for (uint32_t i = 0;; ++i) {
+        uint32_t tselect = 0;
+        _cosim->set_csr(CSR_TSELECT, i);
+        _cosim->get_csr(CSR_TSELECT, tselect);
+        if (tselect != i) {
+          break;
+        }
+
+        read_csr(CSR_TDATA1);
+        read_csr(CSR_TDATA2);
+      }
+
+      _cosim->set_csr(CSR_TSELECT, orig_tselect);
+      csrs.emplace_back(CSR_TSELECT, orig_tselect);
+    }
+
+    return csrs;
+  }
+
+  // Run the first `num_insns` instructions in the co-simulator alone, then
+  // transfer its state to the DUT so checking starts from that point.
+  //
+  // Memory is copied into the DUT RAM via the backdoor. Registers are loaded by
+  // a restore stub placed at the top of RAM, which the DUT jumps to from its
+  // reset PC. The stub writes the machine CSRs, loads every GPR and returns to
+  // the fast forwarded PC with mret. Only the machine CSRs that differ from
+  // their reset values are written, see `FastForwardCsrs`. Once the stub has
+  // run the RAM it overwrote is put back. The checker steps the stub's
+  // instructions one at a time (see `GetUnbatchedInsns`) so this happens as the
+  // final mret retires, before the DUT can execute anything that touches that
+  // RAM. The mret leaves mstatus.MPIE set, mstatus.MPP as U and mepc as the
+  // fast forwarded PC, so the co-simulator is given the same values. These only
+  // matter to an mret without an earlier trap.
+  //
+  // Returns false if the state can't be transferred.
+  bool FastForward(uint64_t num_insns) {
+    std::vector<int> ff_csrs = FastForwardCsrs();
+    std::vector<uint32_t> reset_csr_vals(ff_csrs.size());
+    std::vector<bool> has_csr(ff_csrs.size());
+    for (size_t i = 0; i < ff_csrs.size(); ++i) {
+      has_csr[i] = _cosim->get_csr(ff_csrs[i], reset_csr_vals[i]);
+    }
+
+    auto reset_untransferable_csrs = ReadUntransferableCsrs();
+
+    _cosim->fast_forward(num_insns);
+
+    auto untransferable_csrs = ReadUntransferableCsrs();
+    for (size_t i = 0; i < untransferable_csrs.size(); ++i) {
+      if (untransferable_csrs[i] != reset_untransferable_csrs[i]) {
+        std::cerr << "ERROR: Cannot fast forward, CSR 0x" << std::hex
+                  << untransferable_csrs[i].first << std::dec
+                  << " isn't at its reset value and can't be transferred to "
+                  << "the DUT"
+                  << std::endl;
+        return false;
+      }
+    }
+
+    uint32_t pc = _cosim->get_pc();
+    reg_t priv = _cosim->get_priv();
+    if (_cosim->get_debug_mode() || (priv != PRV_M && priv != PRV_U)) {
+      std::cerr << "ERROR: Cannot fast forward into debug mode" << std::endl;
+      return false;
+    }
+
+    uint32_t mstatus = 0;
+    _cosim->get_csr(CSR_MSTATUS, mstatus);
+    bool mie = get_field(mstatus, MSTATUS_MIE);
+
+    // Interrupts stay disabled until the final mret restores mstatus.MIE
+    uint32_t stub_mstatus = mstatus & ~MSTATUS_MIE;
+    stub_mstatus = set_field(stub_mstatus, MSTATUS_MPIE, mie);
+    stub_mstatus = set_field(stub_mstatus, MSTATUS_MPP, priv);
+
+    uint32_t mcountinhibit = 0;
+    _cosim->get_csr(CSR_MCOUNTINHIBIT, mcountinhibit);
+
+    std::vector<uint32_t> stub;
+    auto emit_csr_write = [&](int csr_num, uint32_t val) {
+      EmitLoadImm(stub, 1, val);
+      stub.push_back(EncodeCsrw(csr_num, 1));
+    };
+
+    emit_csr_write(CSR_MSTATUS, stub_mstatus);
+    for (size_t i = 0; i < ff_csrs.size(); ++i) {
+      uint32_t val;
+      if (has_csr[i] && _cosim->get_csr(ff_csrs[i], val) &&
+          val != reset_csr_vals[i]) {
+        emit_csr_write(ff_csrs[i], val);
+      }
+    }
+    emit_csr_write(CSR_MEPC, pc);
+
+    // minstret counts the rest of the stub, so write it last with those
+    // instructions taken off
+    int num_gprs = GetIsaString().compare(0, 5, "rv32e") == 0 ? 16 : 32;
+    uint64_t minstret = _cosim->get_minstret();
+    if (!(mcountinhibit & 0x4)) {
+      minstret -= 2 * (num_gprs - 1) + 1;
+    }
+    emit_csr_write(CSR_MINSTRETH, minstret >> 32);
+    emit_csr_write(CSR_MINSTRET, minstret);
+
+    for (int i = 1; i < num_gprs; ++i) {
+      EmitLoadImm(stub, i, _cosim->get_gpr(i));
+    }
+    stub.push_back(kMretInsn);
+
+    _ff_stub_addr = kRamBase + kRamSize - stub.size() * 4;
+    if (pc == kResetPc || pc >= _ff_stub_addr) {
+      std::cerr << "ERROR: Cannot fast forward to PC " << std::hex << pc
+                << std::dec << ", it is overwritten by the restore stub"
+                << std::endl;
+      return false;
+    }
+
+    std::vector<uint8_t> ram_data(kRamSize);
+    _cosim->backdoor_read_mem(kRamBase, kRamSize, &ram_data[0]);
+
+    uint32_t reset_offset = kResetPc - kRamBase;
+    uint32_t stub_offset = _ff_stub_addr - kRamBase;
+    _ff_saved_reset_insn.assign(ram_data.begin() + reset_offset,
+                                ram_data.begin() + reset_offset + 4);
+    _ff_saved_stub_mem.assign(ram_data.begin() + stub_offset, ram_data.end());
+
+    uint32_t jal_insn = EncodeJal(0, _ff_stub_addr - kResetPc);
+    memcpy(&ram_data[reset_offset], &jal_insn, 4);
+    memcpy(&ram_data[stub_offset], &stub[0], stub.size() * 4);
+    _ram.Write(0, ram_data);
+
+    // Match the state the DUT is left in by the mret
+    mstatus = set_field(mstatus, MSTATUS_MPIE, 1);
+    mstatus = set_field(mstatus, MSTATUS_MPP, PRV_U);
+    _cosim->set_csr(CSR_MSTATUS, mstatus);
+    _cosim->set_csr(CSR_MEPC, pc);
+
+    std::cout << "Fast forwarded " << num_insns
+              << " instructions in the co-simulator, checking from PC 0x"
+              << std::hex << pc << std::dec << std::endl;
+
+    return true;
+  }
+
+  // Called once the DUT has run the restore stub
+  void OnRestoreStubDone() {
+    _ram.Write((kResetPc - kRamBase) / 4, _ff_saved_reset_insn);
+    _ram.Write((_ff_stub_addr - kRamBase) / 4, _ff_saved_stub_mem);
   }
 
   virtual int Setup(int argc, char **argv, bool &exit_app) override {
@@ -30,22 +379,126 @@ class SimpleSystemCosim : public SimpleSystem {
       return ret_code;
     }
 
-    _cosim =
-        std::make_unique<SpikeCosim>(GetIsaString(), 0x100080, 0x100001,
-                                     "simple_system_cosim.log", false, false);
+    bool cosim_async = false;
+    bool cosim_direct_fetch = false;
+    bool cosim_log = true;
+    uint64_t cosim_fast_forward = 0;
+    std::string cosim_trace_path;
+    for (int i = 1; i < argc; ++i) {
+      if (strcmp(argv[i], "--cosim-async") == 0) {
+        cosim_async = true;
+      } else if (strcmp(argv[i], "--cosim-direct-fetch") == 0) {
+        cosim_direct_fetch = true;
+      } else if (strcmp(argv[i], "--cosim-no-log") == 0) {
+        cosim_log = false;
+      } else if (strncmp(argv[i], "--cosim-fast-forward=", 21) == 0) {
+        cosim_fast_forward = strtoull(argv[i] + 21, nullptr, 0);
+      } else if (strncmp(argv[i], "--cosim-trace=", 14) == 0) {
+        cosim_trace_path = argv[i] + 14;
+      }
+    }
+
+    CosimTraceConfig cosim_config{.isa_string = GetIsaString(),
+                                  .start_pc = 0x100080,
+                                  .start_mtvec = 0x100001,
+                                  .secure_ibex = false,
+                                  .icache_en = false};
+
+    _cosim = std::make_unique<SpikeCosim>(
+        cosim_config.isa_string, cosim_config.start_pc,
+        cosim_config.start_mtvec, cosim_log ? "simple_system_cosim.log" : "",
+        cosim_config.secure_ibex, cosim_config.icache_en);
+
+    if (!cosim_trace_path.empty()) {
+      // A replay starts from reset so can't reproduce a fast forward
+      if (cosim_fast_forward) {
+        std::cerr << "ERROR: --cosim-trace cannot be used with "
+                  << "--cosim-fast-forward" << std::endl;
+        return 1;
+      }
+
+      _trace_cosim = std::make_unique<CosimTraceRecorder>(
+          _cosim.get(), cosim_trace_path, cosim_config);
+      if (!_trace_cosim->is_open()) {
+        std::cerr << "ERROR: Could not open co-simulation trace file "
+                  << cosim_trace_path << std::endl;
+        return 1;
+      }
+
+      std::cout << "Recording co-simulation trace to " << cosim_trace_path
+                << std::endl;
+    }
+
+    GetCosim()->add_memory(kRamBase, kRamSize);
+    GetCosim()->add_memory(0x20000, 4096);
+
+    CopyMemAreaToCosim(&_ram, "ram", kRamBase);
+
+    _cosim->set_direct_fetch(cosim_direct_fetch);
+
+    int num_stub_insns = 0;
+    if (cosim_fast_forward) {
+      if (!FastForward(cosim_fast_forward)) {
+        return 1;
+      }
+
+      // The jump to the stub plus the stub itself
+      num_stub_insns = 1 + (kRamBase + kRamSize - _ff_stub_addr) / 4;
+    }
 
-    _cosim->add_memory(0x100000, 1024 * 1024);
-    _cosim->add_memory(0x20000, 4096);
+    if (cosim_async) {
+      std::cout << "Running co-simulation checks on a separate thread"
+                << std::endl;
+      _async_cosim = std::make_unique<AsyncCosim>(GetCosim());
+    }
 
-    CopyMemAreaToCosim(&_ram, 0x100000);
+    if (cosim_fast_forward) {
+      _ff_cosim = std::make_unique<FastForwardCosim>(
+          GetCosim(), num_stub_insns, [this]() { OnRestoreStubDone(); });
+    }
 
     return 0;
   }
 
+  void PrintCosimStats(const CosimStats &stats) {
+    std::cout << "\nCo-simulation Statistics" << std::endl
+              << "========================" << std::endl
+              << "Instructions stepped:    " << stats.insns_stepped
+              << std::endl
+              << "Dside accesses matched:  " << stats.dside_accesses_matched
+              << " of " << stats.dside_accesses_notified << std::endl
+              << "ISS step time:           " << stats.step_time_ns / 1000000.0
+              << " ms" << std::endl
+              << "  Memory check time:     "
+              << stats.check_mem_time_ns / 1000000.0 << " ms" << std::endl
+              << "DPI calls:               " << stats.dpi_calls << std::endl;
+
+    if (stats.insns_stepped) {
+      std::cout << "DPI calls / instruction: "
+                << (double)stats.dpi_calls / stats.insns_stepped << std::endl;
+    }
+  }
+
   virtual bool Finish() {
-    std::cout << "Co-simulation matched " << _cosim->get_insn_cnt()
+    Cosim *cosim = GetCosim();
+
+    // Checking may still be in progress when running asynchronously, so
+    // collect any errors that haven't yet been reported by the RTL checker.
+    const std::vector<std::string> &errors = cosim->get_errors();
+    if (!errors.empty()) {
+      std::cout << "FAILURE: Co-simulation mismatch seen" << std::endl;
+      for (const std::string &error : errors) {
+        std::cout << error << std::endl;
+      }
+
+      return false;
+    }
+
+    std::cout << "Co-simulation matched " << cosim->get_insn_cnt()
               << " instructions\n";
 
+    PrintCosimStats(cosim->get_stats());
+
     return SimpleSystem::Finish();
   }
 };
@@ -57,7 +510,12 @@ SimpleSystemCosim *simple_system_cosim;
 extern "C" {
 void *get_spike_cosim() {
   assert(simple_system_cosim);
-  return static_cast<Cosim *>(simple_system_cosim->_cosim.get());
+  return simple_system_cosim->GetCosim();
+}
+
+int get_cosim_unbatched_insns() {
+  assert(simple_system_cosim);
+  return simple_system_cosim->GetUnbatchedInsns();
 }
 }
 
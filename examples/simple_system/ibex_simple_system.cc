@@ -3,16 +3,229 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include <cassert>
+#include <cctype>
+#include <cstdlib>
 #include <fstream>
+#include <getopt.h>
 #include <iostream>
 
 #include "Vibex_simple_system__Syms.h"
 #include "ibex_pcounts.h"
 #include "ibex_simple_system.h"
+#include "verilated_syms.h"
 #include "verilated_toplevel.h"
 #include "verilator_memutil.h"
 #include "verilator_sim_ctrl.h"
 
+// Find the public variable `name` of `size` bytes in `scope`, or return null
+static void *FindPublicVar(const char *scope, const char *name, size_t size) {
+  // In Verilator an svScope is a VerilatedScope
+  const VerilatedScope *vl_scope =
+      static_cast<const VerilatedScope *>(svGetScopeFromName(scope));
+  if (!vl_scope) {
+    return nullptr;
+  }
+
+  const VerilatedVar *var = vl_scope->varFind(name);
+  if (!var || var->totalSize() != size) {
+    return nullptr;
+  }
+
+  return var->datap();
+}
+
+SimpleSystemIdleSkip::SimpleSystemIdleSkip()
+    : _core_sleep(nullptr),
+      _mtime(nullptr),
+      _mtimecmp(nullptr),
+      _timer_intr(nullptr) {}
+
+bool SimpleSystemIdleSkip::Resolve() {
+  const char *timer_scope = "TOP.ibex_simple_system.u_timer";
+
+  _core_sleep = static_cast<CData *>(
+      FindPublicVar("TOP.ibex_simple_system", "core_sleep", sizeof(CData)));
+  _mtime = static_cast<QData *>(
+      FindPublicVar(timer_scope, "mtime_q", sizeof(QData)));
+  _mtimecmp = static_cast<const QData *>(
+      FindPublicVar(timer_scope, "mtimecmp_q", sizeof(QData)));
+  _timer_intr = static_cast<const CData *>(
+      FindPublicVar(timer_scope, "interrupt_q", sizeof(CData)));
+
+  return _core_sleep && _mtime && _mtimecmp && _timer_intr;
+}
+
+unsigned long SimpleSystemIdleSkip::IdleCycles() {
+  // The interrupt is raised the cycle after mtime reaches mtimecmp. Stop one
+  // cycle short of that so the model itself clocks mtime up to mtimecmp and
+  // raises the interrupt. If the interrupt is already raised but the core
+  // still sleeps the interrupt isn't enabled, and the core will never wake.
+  if (*_timer_intr || *_mtime >= *_mtimecmp) {
+    return 0;
+  }
+
+  return *_mtimecmp - *_mtime - 1;
+}
+
+void SimpleSystemIdleSkip::SkipCycles(unsigned long cycles) {
+  *_mtime += cycles;
+}
+
+SimpleSystemTraceTrigger::SimpleSystemTraceTrigger()
+    : _pc_trigger_en(false),
+      _pc_trigger(0),
+      _addr_trigger_en(false),
+      _addr_trigger(0),
+      _triggered(false),
+      _rvfi_valid(nullptr),
+      _rvfi_pc_rdata(nullptr),
+      _rvfi_mem_addr(nullptr),
+      _rvfi_mem_rmask(nullptr),
+      _rvfi_mem_wmask(nullptr) {}
+
+unsigned int SimpleSystemTraceTrigger::GetEvents() const {
+  // Only needs to watch retired instructions if a trigger is set
+  return (_pc_trigger_en || _addr_trigger_en) ? EventOnClock : 0;
+}
+
+// Parse a 32-bit address argument, in any base strtoul understands
+static bool ParseAddrArg(const char *arg_name, const char *arg_text,
+                         uint32_t &addr) {
+  char *txt_end;
+  unsigned long val = strtoul(arg_text, &txt_end, 0);
+  if (!*arg_text || *txt_end || val > 0xffffffffUL) {
+    std::cerr << "ERROR: Bad format for " << arg_name << " argument: `"
+              << arg_text << "' is not a 32-bit address." << std::endl;
+    return false;
+  }
+
+  addr = val;
+  return true;
+}
+
+bool SimpleSystemTraceTrigger::ParseCLIArguments(int argc, char **argv,
+                                                 bool &exit_app) {
+  const struct option long_options[] = {
+      {"trace-trigger-pc", required_argument, nullptr, 'P'},
+      {"trace-trigger-addr", required_argument, nullptr, 'A'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, no_argument, nullptr, 0}};
+
+  // Reset the command parsing index in-case other utils have already parsed
+  // some arguments
+  optind = 1;
+  while (1) {
+    int c = getopt_long(argc, argv, "-:h", long_options, nullptr);
+    if (c == -1) {
+      break;
+    }
+
+    // Disable error reporting by getopt
+    opterr = 0;
+
+    switch (c) {
+      case 'P':
+        if (!ParseAddrArg("trace-trigger-pc", optarg, _pc_trigger)) {
+          return false;
+        }
+        _pc_trigger_en = true;
+        break;
+      case 'A':
+        if (!ParseAddrArg("trace-trigger-addr", optarg, _addr_trigger)) {
+          return false;
+        }
+        _addr_trigger_en = true;
+        break;
+      case 'h':
+        std::cout << "--trace-trigger-pc=ADDR\n"
+                     "  Start tracing when the instruction at ADDR retires\n\n"
+                     "--trace-trigger-addr=ADDR\n"
+                     "  Start tracing when an instruction accessing the word\n"
+                     "  at ADDR retires\n\n";
+        return true;
+      default:;
+        // Ignore other options since they might be consumed by other utils
+    }
+  }
+
+  if (!_pc_trigger_en && !_addr_trigger_en) {
+    return true;
+  }
+
+  if (!VerilatorSimCtrl::GetInstance().TracingPossible()) {
+    std::cerr << "ERROR: Tracing has not been enabled at compile time."
+              << std::endl;
+    return false;
+  }
+
+  const char *scope = "TOP.ibex_simple_system.u_top";
+  _rvfi_valid = static_cast<const CData *>(
+      FindPublicVar(scope, "rvfi_valid", sizeof(CData)));
+  _rvfi_pc_rdata = static_cast<const IData *>(
+      FindPublicVar(scope, "rvfi_pc_rdata", sizeof(IData)));
+  _rvfi_mem_addr = static_cast<const IData *>(
+      FindPublicVar(scope, "rvfi_mem_addr", sizeof(IData)));
+  _rvfi_mem_rmask = static_cast<const CData *>(
+      FindPublicVar(scope, "rvfi_mem_rmask", sizeof(CData)));
+  _rvfi_mem_wmask = static_cast<const CData *>(
+      FindPublicVar(scope, "rvfi_mem_wmask", sizeof(CData)));
+  if (!_rvfi_valid || !_rvfi_pc_rdata || !_rvfi_mem_addr || !_rvfi_mem_rmask ||
+      !_rvfi_mem_wmask) {
+    std::cerr << "ERROR: RVFI signals are not accessible, trace triggers "
+                 "cannot be used."
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+void SimpleSystemTraceTrigger::OnClock(unsigned long sim_time) {
+  if (_triggered || !*_rvfi_valid) {
+    return;
+  }
+
+  bool pc_hit = _pc_trigger_en && *_rvfi_pc_rdata == _pc_trigger;
+  bool addr_hit = _addr_trigger_en &&
+                  (*_rvfi_mem_rmask || *_rvfi_mem_wmask) &&
+                  (*_rvfi_mem_addr >> 2) == (_addr_trigger >> 2);
+  if (pc_hit || addr_hit) {
+    _triggered = true;
+    VerilatorSimCtrl::GetInstance().TriggerTrace();
+  }
+}
+
+extern "C" {
+extern unsigned long long mhpmcounter_get(int index);
+}
+
+void SimpleSystemStats::PostExec() {
+  VerilatorSimCtrl &simctrl = VerilatorSimCtrl::GetInstance();
+
+  // See SimpleSystem::Finish()
+  svSetScope(svGetScopeFromName("TOP.ibex_simple_system"));
+
+  // Named as in ibex_pcount_string, e.g. "Instructions Retired" becomes
+  // "instructions_retired"
+  for (size_t i = 0; i < ibex_counter_names.size(); ++i) {
+    if (ibex_counter_names[i] == "NONE") {
+      continue;
+    }
+
+    std::string name;
+    for (char c : ibex_counter_names[i]) {
+      name += c == ' ' ? '_' : static_cast<char>(tolower(c));
+    }
+    simctrl.SetStatistic(name, mhpmcounter_get(i));
+  }
+
+  // Counters 0 and 2 are mcycle and minstret
+  unsigned long long cycles = mhpmcounter_get(0);
+  if (cycles) {
+    simctrl.SetStatistic("ipc", mhpmcounter_get(2) / (double)cycles);
+  }
+}
+
 SimpleSystem::SimpleSystem(const char *ram_hier_path, int ram_size_words)
     : _ram(ram_hier_path, ram_size_words, 4) {}
 
@@ -74,6 +287,13 @@ int SimpleSystem::Setup(int argc, char **argv, bool &exit_app) {
   _memutil.RegisterMemoryArea("ram", 0x0, &_ram);
   simctrl.RegisterExtension(&_memutil);
 
+  simctrl.RegisterExtension(&_trace_trigger);
+  simctrl.RegisterExtension(&_stats);
+
+  if (_idle_skip.Resolve()) {
+    simctrl.SetIdleSkip(_idle_skip.GetSleepSignal(), &_idle_skip);
+  }
+
   exit_app = false;
   return simctrl.ParseCommandArgs(argc, argv, exit_app);
 }
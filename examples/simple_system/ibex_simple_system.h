@@ -2,9 +2,69 @@
 // Licensed under the Apache License, Version 2.0, see LICENSE for details.
 // SPDX-License-Identifier: Apache-2.0
 
+#include "sim_ctrl_extension.h"
+#include "sim_ctrl_idle_skip.h"
 #include "verilated_toplevel.h"
+#include "verilator_direct_mem_area.h"
 #include "verilator_memutil.h"
 
+// Skips cycles in which the core sleeps waiting for the timer interrupt, by
+// advancing the timer's mtime. The timer interrupt is the only interrupt
+// source in Simple System so nothing else can wake the core.
+class SimpleSystemIdleSkip : public SimCtrlIdleSkip {
+ public:
+  SimpleSystemIdleSkip();
+
+  // Find the core sleep signal and timer registers in the model. Returns
+  // false if they aren't accessible (they must be public, see
+  // lint/verilator_waiver.vlt).
+  bool Resolve();
+
+  CData *GetSleepSignal() const { return _core_sleep; }
+
+  unsigned long IdleCycles() override;
+  void SkipCycles(unsigned long cycles) override;
+
+ private:
+  CData *_core_sleep;
+  QData *_mtime;
+  const QData *_mtimecmp;
+  const CData *_timer_intr;
+};
+
+// Starts tracing when the core retires an instruction at a given PC, or one
+// that accesses the word at a given data address. Uses the RVFI signals of
+// ibex_top_tracing, which must be public (see lint/verilator_waiver.vlt).
+class SimpleSystemTraceTrigger : public SimCtrlExtension {
+ public:
+  SimpleSystemTraceTrigger();
+
+  unsigned int GetEvents() const override;
+  bool ParseCLIArguments(int argc, char **argv, bool &exit_app) override;
+  void OnClock(unsigned long sim_time) override;
+
+ private:
+  bool _pc_trigger_en;
+  uint32_t _pc_trigger;
+  bool _addr_trigger_en;
+  uint32_t _addr_trigger;
+  bool _triggered;
+
+  const CData *_rvfi_valid;
+  const IData *_rvfi_pc_rdata;
+  const IData *_rvfi_mem_addr;
+  const CData *_rvfi_mem_rmask;
+  const CData *_rvfi_mem_wmask;
+};
+
+// Adds the performance counters to the simulation statistics (see
+// --stats-json), read at the end of the simulation
+class SimpleSystemStats : public SimCtrlExtension {
+ public:
+  unsigned int GetEvents() const override { return EventPostExec; }
+  void PostExec() override;
+};
+
 class SimpleSystem {
  public:
   SimpleSystem(const char *ram_hier_path, int ram_size_words);
@@ -18,7 +78,10 @@ class SimpleSystem {
  protected:
   ibex_simple_system _top;
   VerilatorMemUtil _memutil;
-  MemArea _ram;
+  VerilatorDirectMemArea<MemArea> _ram;
+  SimpleSystemIdleSkip _idle_skip;
+  SimpleSystemTraceTrigger _trace_trigger;
+  SimpleSystemStats _stats;
 
   virtual int Setup(int argc, char **argv, bool &exit_app);
   virtual void Run();
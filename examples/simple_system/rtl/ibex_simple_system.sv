@@ -72,6 +72,9 @@ module ibex_simple_system (
   // interrupts
   logic timer_irq;
 
+  // Core is sleeping (in WFI), used to skip idle cycles in simulation
+  logic core_sleep;
+
   // host and device signals
   logic           host_req    [NrHosts];
   logic           host_gnt    [NrHosts];
@@ -257,7 +260,7 @@ module ibex_simple_system (
       .alert_minor_o          (),
       .alert_major_internal_o (),
       .alert_major_bus_o      (),
-      .core_sleep_o           ()
+      .core_sleep_o           (core_sleep)
     );
 
   // SRAM block for instruction and data storage
@@ -0,0 +1,63 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+// Loads data from the page the program is executing from. Run with
+// co-simulation (and `--cosim-direct-fetch`) to check that loads from a code
+// page are still checked against the DUT once Spike fetches from it directly.
+
+#include "simple_system_common.h"
+
+#define CODE_PAGE_SIZE 4096
+// `j 1f` where 1f immediately follows it (jal x0, 4)
+#define JUMP_NEXT_INSN 0x0040006f
+
+// Load the instruction following the load itself, which is within the bytes
+// Spike may fetch for the load.
+static uint32_t load_next_insn(void) {
+  uint32_t val;
+
+  asm volatile(
+      ".option push\n"
+      ".option norvc\n"
+      "  auipc %0, 0\n"
+      "  lw %0, 8(%0)\n"
+      "  j 1f\n"
+      "1:\n"
+      ".option pop\n"
+      : "=r"(val));
+
+  return val;
+}
+
+// Sum every word of the code page holding this function
+static uint32_t sum_code_page(void) {
+  const volatile uint32_t *page =
+      (const volatile uint32_t *)((uintptr_t)&sum_code_page &
+                                  ~(uintptr_t)(CODE_PAGE_SIZE - 1));
+  uint32_t sum = 0;
+
+  for (int i = 0; i < CODE_PAGE_SIZE / 4; ++i) {
+    sum += page[i];
+  }
+
+  return sum;
+}
+
+int main(int argc, char **argv) {
+  int failed = 0;
+
+  // Repeat so later loads follow fetches from the same page
+  for (int i = 0; i < 4; ++i) {
+    if (load_next_insn() != JUMP_NEXT_INSN) {
+      failed = 1;
+    }
+
+    puthex(sum_code_page());
+    putchar('\n');
+  }
+
+  puts(failed ? "FAIL\n" : "PASS\n");
+
+  return 0;
+}